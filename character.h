@@ -34,6 +34,7 @@
 
 // Qt includes
 #include <QHash>
+#include <QString>
 
 typedef unsigned char LineProperty;
 
@@ -67,28 +68,25 @@ public:
    * @param _b The color used to draw the character's background.
    * @param _r A set of rendition flags which specify how this character is to be drawn.
    */
-    inline Character(quint16 _c = ' ',
+    inline Character(uint _c = ' ',
                      CharacterColor  _f = CharacterColor(COLOR_SPACE_DEFAULT,DEFAULT_FORE_COLOR),
                      CharacterColor  _b = CharacterColor(COLOR_SPACE_DEFAULT,DEFAULT_BACK_COLOR),
                      quint8  _r = DEFAULT_RENDITION)
         : character(_c), rendition(_r), foregroundColor(_f), backgroundColor(_b) {}
 
-    union
-    {
-        /** The unicode character value for this character. */
-        quint16 character;
-        /**
-     * Experimental addition which allows a single Character instance to contain more than
-     * one unicode character.
-     *
-     * charSequence is a hash code which can be used to look up the unicode
-     * character sequence in the ExtendedCharTable used to create the sequence.
-     */
-        quint16 charSequence;
-    };
+    /**
+   * The unicode code point of this character.
+   *
+   * If the RE_EXTENDED_CHAR rendition flag is set, this is instead a hash code
+   * which can be used to look up a sequence of unicode characters in the
+   * ExtendedCharTable used to create the sequence.
+   *
+   * The code point and the rendition share a single 32 bit word.
+   */
+    quint32 character : 21;
 
     /** A combination of RENDITION flags which specify options for drawing the character. */
-    quint8  rendition;
+    quint32 rendition : 11;
 
     /** The foreground color used to draw this character. */
     CharacterColor  foregroundColor;
@@ -142,10 +140,8 @@ inline bool operator != (const Character& a, const Character& b)
 
 inline bool Character::isTransparent(const ColorEntry* base) const
 {
-    return ((backgroundColor._colorSpace == COLOR_SPACE_DEFAULT) &&
-            base[backgroundColor._u+0+(backgroundColor._v?BASE_COLORS:0)].transparent)
-            || ((backgroundColor._colorSpace == COLOR_SPACE_SYSTEM) &&
-                base[backgroundColor._u+2+(backgroundColor._v?BASE_COLORS:0)].transparent);
+    int index = backgroundColor.paletteIndex();
+    return index >= 0 && base[index].transparent;
 }
 
 inline bool Character::equalsFormat(const Character& other) const
@@ -158,22 +154,37 @@ inline bool Character::equalsFormat(const Character& other) const
 
 inline ColorEntry::FontWeight Character::fontWeight(const ColorEntry* base) const
 {
-    if (backgroundColor._colorSpace == COLOR_SPACE_DEFAULT)
-        return base[backgroundColor._u+0+(backgroundColor._v?BASE_COLORS:0)].fontWeight;
-    else if (backgroundColor._colorSpace == COLOR_SPACE_SYSTEM)
-        return base[backgroundColor._u+2+(backgroundColor._v?BASE_COLORS:0)].fontWeight;
+    int index = backgroundColor.paletteIndex();
+    if (index >= 0)
+        return base[index].fontWeight;
     else
         return ColorEntry::UseCurrentFormat;
 }
 
 extern unsigned short vt100_graphics[32];
 
+/**
+ * Appends the unicode code point @p c to @p string, as a surrogate pair if
+ * it lies outside the basic multilingual plane.
+ */
+inline void appendCodePoint(QString& string, uint c)
+{
+    if (QChar::requiresSurrogates(c))
+    {
+        string.append(QChar(QChar::highSurrogate(c)));
+        string.append(QChar(QChar::lowSurrogate(c)));
+    }
+    else
+    {
+        string.append(QChar(c));
+    }
+}
+
 
 /**
  * A table which stores sequences of unicode characters, referenced
- * by hash keys.  The hash key itself is the same size as a unicode
- * character ( ushort ) so that it can occupy the same space in
- * a structure.
+ * by hash keys.  The hash key itself fits into the space of a unicode
+ * character so that it can occupy the same space in a structure.
  */
 class ExtendedCharTable
 {
@@ -183,7 +194,7 @@ public:
     ~ExtendedCharTable();
 
     /**
-     * Adds a sequences of unicode characters to the table and returns
+     * Adds a sequences of unicode code points to the table and returns
      * a hash code which can be used later to look up the sequence
      * using lookupExtendedChar()
      *
@@ -193,9 +204,9 @@ public:
      * @param unicodePoints An array of unicode character points
      * @param length Length of @p unicodePoints
      */
-    ushort createExtendedChar(ushort* unicodePoints , ushort length);
+    ushort createExtendedChar(uint* unicodePoints , ushort length);
     /**
-     * Looks up and returns a pointer to a sequence of unicode characters
+     * Looks up and returns a pointer to a sequence of unicode code points
      * which was added to the table using createExtendedChar().
      *
      * @param hash The hash key returned by createExtendedChar()
@@ -204,20 +215,24 @@ public:
      *
      * @return A unicode character sequence of size @p length.
      */
-    ushort* lookupExtendedChar(ushort hash , ushort& length) const;
+    uint* lookupExtendedChar(ushort hash , ushort& length) const;
 
     /** The global ExtendedCharTable instance. */
     static ExtendedCharTable instance;
 private:
     // calculates the hash key of a sequence of unicode points of size 'length'
-    ushort extendedCharHash(ushort* unicodePoints , ushort length) const;
+    ushort extendedCharHash(uint* unicodePoints , ushort length) const;
     // tests whether the entry in the table specified by 'hash' matches the
     // character sequence 'unicodePoints' of size 'length'
-    bool extendedCharMatch(ushort hash , ushort* unicodePoints , ushort length) const;
-    // internal, maps hash keys to character sequence buffers.  The first ushort
-    // in each value is the length of the buffer, followed by the ushorts in the buffer
-    // themselves.
-    QHash<ushort,ushort*> extendedCharTable;
+    bool extendedCharMatch(ushort hash , uint* unicodePoints , ushort length) const;
+    // internal, maps hash keys to character sequence buffers.  The first uint
+    // in each value is the length of the buffer, followed by the code points in
+    // the buffer themselves.
+    QHash<ushort,uint*> extendedCharTable;
 };
 
 Q_DECLARE_TYPEINFO(Character, Q_MOVABLE_TYPE);
+
+// Screen images, window buffers and history files are copied and compared
+// cell by cell, so keep the cell small.
+static_assert(sizeof(Character) == 8, "Character should occupy 8 bytes");
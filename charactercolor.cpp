@@ -0,0 +1,93 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+// Own includes
+#include "charactercolor.h"
+
+// Qt includes
+#include <QBitArray>
+
+RgbColorTable::RgbColorTable()
+    : _usedIndices(0)
+{
+}
+
+int RgbColorTable::intern(QRgb rgb)
+{
+    QHash<QRgb,int>::const_iterator it = _indices.constFind(rgb);
+    if (it != _indices.constEnd())
+        return it.value();
+
+    int index;
+    if (!_freeIndices.isEmpty())
+        index = _freeIndices.takeLast();
+    else if (_usedIndices < Capacity)
+        index = _usedIndices++;
+    else
+        return -1;
+
+    // the color is stored before its index is handed out, so readers never
+    // see an index whose color has not been written yet
+    _colors[index].storeRelease(int(rgb));
+    _indices.insert(rgb, index);
+    return index;
+}
+
+QRgb RgbColorTable::lookup(int index) const
+{
+    Q_ASSERT(index >= 0 && index < Capacity);
+    return QRgb(_colors[index].loadAcquire());
+}
+
+int RgbColorTable::count() const
+{
+    return _indices.count();
+}
+
+void RgbColorTable::reclaim(const QBitArray& used)
+{
+    const int oldCount = _indices.count();
+
+    QHash<QRgb,int>::iterator it = _indices.begin();
+    while (it != _indices.end())
+    {
+        if (used.testBit(it.value()))
+        {
+            ++it;
+        }
+        else
+        {
+            _freeIndices.append(it.value());
+            it = _indices.erase(it);
+        }
+    }
+
+    if (_indices.count() != oldCount)
+        _generation.ref();
+}
+
+int RgbColorTable::generation() const
+{
+    return _generation.loadAcquire();
+}
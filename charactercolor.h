@@ -30,7 +30,12 @@
 #pragma once
 
 // Qt includes
+#include <QAtomicInt>
 #include <QColor>
+#include <QHash>
+#include <QVector>
+
+class QBitArray;
 
 #define KDE_NO_EXPORT
 
@@ -124,15 +129,16 @@ extern const ColorEntry base_color_table[TABLE_COLORS] KDE_NO_EXPORT;
 
 /* CharacterColor is a union of the various color spaces.
 
-   Assignment is as follows:
+   The color is packed into 16 bits: the color space is kept in the top
+   three bits and the value in the remaining 13 bits.
 
-   Type  - Space        - Values
+   Type  - Space        - Value
 
-   0     - Undefined   - u:  0,      v:0        w:0
-   1     - Default     - u:  0..1    v:intense  w:0
-   2     - System      - u:  0..7    v:intense  w:0
-   3     - Index(256)  - u: 16..255  v:0        w:0
-   4     - RGB         - u:  0..255  v:0..256   w:0..256
+   0     - Undefined   - 0
+   1     - Default     - bit 0: default fore/background, bit 8: intense
+   2     - System      - bits 0..2: color,               bit 8: intense
+   3     - Index(256)  - bits 0..7: index 16..255
+   4     - RGB         - index into the RgbColorTable
 
    Default colour space has two separate colours, namely
    default foreground and default background colour.
@@ -144,6 +150,66 @@ extern const ColorEntry base_color_table[TABLE_COLORS] KDE_NO_EXPORT;
 #define COLOR_SPACE_256         3
 #define COLOR_SPACE_RGB         4
 
+#define COLOR_SPACE_SHIFT       13
+#define COLOR_VALUE_MASK        ((1 << COLOR_SPACE_SHIFT) - 1)
+#define COLOR_INTENSIVE         (1 << 8)
+
+/**
+ * Interns the RGB colors used by CharacterColor, so that a character cell
+ * only has to store a 13 bit index for them.
+ *
+ * Every screen has a table of its own.  When it is full, the screen hands
+ * the entries which neither its cells nor its history refer to any more
+ * back to the table with reclaim().  Should a program still use more
+ * distinct RGB colors at a time than there are indices, the remaining
+ * colors are approximated with the closest entry of the 256 color cube.
+ *
+ * intern() and reclaim() are only called by the screen, with the screen
+ * lock held, lookup() may be called from any thread.
+ */
+class RgbColorTable
+{
+public:
+    /** The number of RGB colors which can be interned. */
+    static const int Capacity = 1 << COLOR_SPACE_SHIFT;
+
+    RgbColorTable();
+
+    /**
+     * Returns the index of @p rgb in the table, adding it if necessary, or
+     * -1 if the table is full.
+     */
+    int intern(QRgb rgb);
+
+    /** Returns the color stored at @p index, which was returned by intern(). */
+    QRgb lookup(int index) const;
+
+    /** Returns the number of colors in the table. */
+    int count() const;
+
+    /**
+     * Removes the colors whose index is not set in @p used, so that their
+     * indices can be handed out again.
+     */
+    void reclaim(const QBitArray& used);
+
+    /**
+     * Returns a number which changes whenever reclaim() removes colors.  A
+     * copy of the screen's cells which was taken before may then refer to
+     * colors which have been replaced and has to be drawn again.
+     */
+    int generation() const;
+
+private:
+    Q_DISABLE_COPY(RgbColorTable)
+
+    QHash<QRgb,int> _indices;
+    QVector<int> _freeIndices;  // indices given back by reclaim()
+    int _usedIndices;           // indices handed out at least once
+    QAtomicInt _colors[Capacity];
+    QAtomicInt _generation;
+};
+
 /**
  * Describes the color of a single character in the terminal.
  */
@@ -154,10 +220,7 @@ class CharacterColor
 public:
     /** Constructs a new CharacterColor whoose color and color space are undefined. */
     CharacterColor()
-        : _colorSpace(COLOR_SPACE_UNDEFINED),
-          _u(0),
-          _v(0),
-          _w(0)
+        : _data(0)
     {}
 
     /**
@@ -169,32 +232,35 @@ public:
    * TODO : Document how @p co relates to @p colorSpace
    *
    * TODO : Add documentation about available color spaces.
+   *
+   * RGB colors are interned in @p rgbColors, or approximated with the
+   * closest entry of the 256 color cube if it is 0 or full.
    */
-    CharacterColor(quint8 colorSpace, int co)
-        : _colorSpace(colorSpace),
-          _u(0),
-          _v(0),
-          _w(0)
+    CharacterColor(quint8 colorSpace, int co, RgbColorTable* rgbColors = 0)
+        : _data(0)
     {
         switch (colorSpace)
         {
         case COLOR_SPACE_DEFAULT:
-            _u = co & 1;
+            setData(colorSpace, co & 1);
             break;
         case COLOR_SPACE_SYSTEM:
-            _u = co & 7;
-            _v = (co >> 3) & 1;
+            setData(colorSpace, (co & 7) | (((co >> 3) & 1) ? COLOR_INTENSIVE : 0));
             break;
         case COLOR_SPACE_256:
-            _u = co & 255;
+            setData(colorSpace, co & 255);
             break;
         case COLOR_SPACE_RGB:
-            _u = co >> 16;
-            _v = co >> 8;
-            _w = co;
+        {
+            int index = rgbColors ? rgbColors->intern(qRgb((co >> 16) & 255, (co >> 8) & 255, co & 255)) : -1;
+            if (index >= 0)
+                setData(colorSpace, index);
+            else
+                setData(COLOR_SPACE_256, closestColor256(co));
             break;
+        }
         default:
-            _colorSpace = COLOR_SPACE_UNDEFINED;
+            break;
         }
     }
 
@@ -203,7 +269,7 @@ public:
    */
     bool isValid()
     {
-        return _colorSpace != COLOR_SPACE_UNDEFINED;
+        return colorSpace() != COLOR_SPACE_UNDEFINED;
     }
     
     /**
@@ -215,13 +281,21 @@ public:
    */
     void toggleIntensive();
 
+    /**
+   * Returns the index of this color in the screen's RgbColorTable, or -1 if
+   * this is not an RGB color.
+   */
+    int rgbIndex() const
+    { return colorSpace() == COLOR_SPACE_RGB ? value() : -1; }
+
     /**
    * Returns the color within the specified color @p palette
    *
    * The @p palette is only used if this color is one of the 16 system colors, otherwise
-   * it is ignored.
+   * it is ignored.  RGB colors are looked up in @p rgbColors, the table of the
+   * screen which the color was taken from.
    */
-    QColor color(const ColorEntry* palette) const;
+    QColor color(const ColorEntry* palette, const RgbColorTable* rgbColors = 0) const;
 
     /**
    * Compares two colors and returns true if they represent the same color value and
@@ -235,24 +309,29 @@ public:
     friend bool operator != (const CharacterColor& a, const CharacterColor& b);
 
 private:
-    quint8 _colorSpace;
+    quint8 colorSpace() const { return _data >> COLOR_SPACE_SHIFT; }
+    int value() const { return _data & COLOR_VALUE_MASK; }
+    void setData(quint8 colorSpace, int value)
+    { _data = (colorSpace << COLOR_SPACE_SHIFT) | value; }
+
+    // returns the index of the color in a palette of TABLE_COLORS entries,
+    // or -1 if the color is not taken from the palette
+    int paletteIndex() const;
 
-    // bytes storing the character color
-    quint8 _u;
-    quint8 _v;
-    quint8 _w;
+    // returns the entry of the 256 color cube which is closest to the RGB color 'rgb'
+    static int closestColor256(int rgb);
+
+    // color space and value, see above
+    quint16 _data;
 };
 
 inline bool operator == (const CharacterColor& a, const CharacterColor& b)
 { 
-    return     a._colorSpace == b._colorSpace &&
-            a._u == b._u &&
-            a._v == b._v &&
-            a._w == b._w;
+    return a._data == b._data;
 }
 inline bool operator != (const CharacterColor& a, const CharacterColor& b)
 {
-    return !operator==(a,b);
+    return a._data != b._data;
 }
 
 inline const QColor color256(quint8 u, const ColorEntry* base)
@@ -270,14 +349,37 @@ inline const QColor color256(quint8 u, const ColorEntry* base)
     int gray = u*10+8; return QColor(gray,gray,gray);
 }
 
-inline QColor CharacterColor::color(const ColorEntry* base) const
+inline int CharacterColor::paletteIndex() const
+{
+    int intensive = (_data & COLOR_INTENSIVE) ? BASE_COLORS : 0;
+    switch (colorSpace())
+    {
+    case COLOR_SPACE_DEFAULT: return (_data & 1) + 0 + intensive;
+    case COLOR_SPACE_SYSTEM: return (_data & 7) + 2 + intensive;
+    default: return -1;
+    }
+}
+
+inline int CharacterColor::closestColor256(int rgb)
+{
+    // the levels of the color cube are 0, 95, 135, 175, 215 and 255
+    int level[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int component = (rgb >> (16 - 8 * i)) & 255;
+        level[i] = component < 48 ? 0 : component < 115 ? 1 : (component - 35) / 40;
+    }
+    return 16 + 36 * level[0] + 6 * level[1] + level[2];
+}
+
+inline QColor CharacterColor::color(const ColorEntry* base, const RgbColorTable* rgbColors) const
 {
-    switch (_colorSpace)
+    switch (colorSpace())
     {
-    case COLOR_SPACE_DEFAULT: return base[_u+0+(_v?BASE_COLORS:0)].color;
-    case COLOR_SPACE_SYSTEM: return base[_u+2+(_v?BASE_COLORS:0)].color;
-    case COLOR_SPACE_256: return color256(_u,base);
-    case COLOR_SPACE_RGB: return QColor(_u,_v,_w);
+    case COLOR_SPACE_DEFAULT:
+    case COLOR_SPACE_SYSTEM: return base[paletteIndex()].color;
+    case COLOR_SPACE_256: return color256(value(),base);
+    case COLOR_SPACE_RGB: return rgbColors ? QColor(rgbColors->lookup(value())) : QColor();
     case COLOR_SPACE_UNDEFINED: return QColor();
     }
 
@@ -288,8 +390,8 @@ inline QColor CharacterColor::color(const ColorEntry* base) const
 
 inline void CharacterColor::toggleIntensive()
 {
-    if (_colorSpace == COLOR_SPACE_SYSTEM || _colorSpace == COLOR_SPACE_DEFAULT)
+    if (colorSpace() == COLOR_SPACE_SYSTEM || colorSpace() == COLOR_SPACE_DEFAULT)
     {
-        _v = !_v;
+        _data ^= COLOR_INTENSIVE;
     }
 }
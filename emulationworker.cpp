@@ -0,0 +1,69 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+// Own includes
+#include "emulationworker.h"
+#include "terminalemulation.h"
+
+// Qt includes
+#include <QMetaObject>
+
+EmulationWorker::EmulationWorker(TerminalEmulation* emulation)
+    : QObject(0),
+      _emulation(emulation),
+      _pendingBytes(0),
+      _drainThreshold(0)
+{
+}
+
+void EmulationWorker::queueData(const char* data, int length)
+{
+    _pendingBytes.fetchAndAddOrdered(length);
+    QMetaObject::invokeMethod(this, "receiveData", Qt::QueuedConnection,
+                              Q_ARG(QByteArray, QByteArray(data, length)));
+}
+
+int EmulationWorker::pendingBytes() const
+{
+    return _pendingBytes.load();
+}
+
+void EmulationWorker::setDrainThreshold(int threshold)
+{
+    _drainThreshold.store(threshold);
+}
+
+void EmulationWorker::receiveData(QByteArray data)
+{
+    if (data.isEmpty())
+        return;
+
+    _emulation->receiveData(data.constData(), data.size());
+
+    int threshold = _drainThreshold.load();
+    int pending = _pendingBytes.fetchAndAddOrdered(-data.size()) - data.size();
+    if (pending < threshold && pending + data.size() >= threshold)
+        emit drained();
+}
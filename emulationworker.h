@@ -0,0 +1,87 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#pragma once
+
+// Own includes
+class TerminalEmulation;
+
+// Qt includes
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QObject>
+
+/**
+ * Feeds the output of the terminal program into a terminal emulation on a
+ * thread other than the GUI thread.
+ *
+ * The worker is moved to a dedicated thread, while the emulation itself stays
+ * in the GUI thread.  Blocks of input are queued to receiveData(), which
+ * parses them and updates the screens while holding the emulation's
+ * TerminalEmulation::screenLock().  The views are notified of the changes
+ * through the emulation's usual buffered updates in the GUI thread.
+ *
+ * The worker keeps count of the bytes which are queued but not yet parsed,
+ * so that the owner can stop reading from the terminal program when the
+ * worker falls too far behind.
+ */
+class EmulationWorker : public QObject {
+    Q_OBJECT
+
+public:
+    /** Constructs a worker which feeds @p emulation. */
+    EmulationWorker(TerminalEmulation* emulation);
+
+    /**
+     * Copies @p length bytes of @p data and queues them for receiveData().
+     * Must be called from the thread the worker was created in.
+     */
+    void queueData(const char* data, int length);
+
+    /** Returns the number of bytes queued with queueData() and not yet parsed. */
+    int pendingBytes() const;
+
+    /**
+     * Sets the number of pending bytes below which drained() is emitted.
+     * Defaults to 0, which means drained() is never emitted.
+     */
+    void setDrainThreshold(int threshold);
+
+public slots:
+    /** Passes @p data to the emulation's receiveData(). */
+    void receiveData(QByteArray data);
+
+signals:
+    /**
+     * Emitted from the worker's thread when the number of pending bytes
+     * drops below the drain threshold.
+     */
+    void drained();
+
+private:
+    TerminalEmulation* _emulation;
+    QAtomicInt _pendingBytes;
+    QAtomicInt _drainThreshold;
+};
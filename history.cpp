@@ -29,6 +29,7 @@
 #include "history.h"
 
 // System includes
+#include <algorithm>
 #include <iostream>
 #include <stdlib.h>
 #include <assert.h>
@@ -43,7 +44,6 @@
 
 // Reasonable line size
 #define LINE_SIZE    1024
-#define KDE_lseek lseek
 
 /*
    An arbitrary long scroll.
@@ -92,8 +92,16 @@ FIXME: There is noticeable decrease in speed, also. Perhaps,
 HistoryFile::HistoryFile()
     : ion(-1),
       length(0),
-      fileMap(0)
+      capacity(0),
+      useCount(0)
 {
+    for (int i = 0; i < WINDOW_COUNT; i++)
+    {
+        windows[i].index = -1;
+        windows[i].data = 0;
+        windows[i].lastUse = 0;
+    }
+
     if (tmpFile.open())
     {
         tmpFile.setAutoRemove(true);
@@ -103,82 +111,109 @@ HistoryFile::HistoryFile()
 
 HistoryFile::~HistoryFile()
 {
-    if (fileMap)
-        unmap();
+    for (int i = 0; i < WINDOW_COUNT; i++)
+    {
+        if (windows[i].data)
+            munmap(windows[i].data, WINDOW_SIZE);
+    }
 }
 
-//TODO:  Mapping the entire file in will cause problems if the history file becomes exceedingly large,
-//(ie. larger than available memory).  HistoryFile::map() should only map in sections of the file at a time,
-//to avoid this.
-void HistoryFile::map()
+const char* HistoryFile::mapWindow(qint64 window)
 {
-    assert( fileMap == 0 );
-
-    fileMap = (char*)mmap( 0 , length , PROT_READ , MAP_PRIVATE , ion , 0 );
+    // only windows which lie entirely within the file can be mapped
+    if ((window+1)*WINDOW_SIZE > capacity)
+        return 0;
 
-    //if mmap'ing fails, fall back to the read-lseek combination
-    if ( fileMap == MAP_FAILED )
+    int victim = 0;
+    for (int i = 0; i < WINDOW_COUNT; i++)
     {
-        readWriteBalance = 0;
-        fileMap = 0;
-        qDebug() << __FILE__ << __LINE__ << ": mmap'ing history failed.  errno = " << errno;
+        if (windows[i].data && windows[i].index == window)
+        {
+            windows[i].lastUse = ++useCount;
+            return windows[i].data;
+        }
+        if (windows[i].lastUse < windows[victim].lastUse)
+            victim = i;
     }
-}
 
-void HistoryFile::unmap()
-{
-    int result = munmap( fileMap , length );
-    assert( result == 0 ); Q_UNUSED( result );
+    MappedWindow& slot = windows[victim];
+    if (slot.data)
+        munmap(slot.data, WINDOW_SIZE);
 
-    fileMap = 0;
-}
+    void* data = mmap(0, WINDOW_SIZE, PROT_READ, MAP_SHARED, ion, window*WINDOW_SIZE);
 
-bool HistoryFile::isMapped()
-{
-    return (fileMap != 0);
+    //if mmap'ing fails, fall back to reading from the file
+    if (data == MAP_FAILED)
+    {
+        slot.index = -1;
+        slot.data = 0;
+        slot.lastUse = 0;
+        qDebug() << __FILE__ << __LINE__ << ": mmap'ing history failed.  errno = " << errno;
+        return 0;
+    }
+
+    slot.index = window;
+    slot.data = (char*)data;
+    slot.lastUse = ++useCount;
+    return slot.data;
 }
 
 void HistoryFile::add(const unsigned char* bytes, int len)
 {
-    if ( fileMap )
-        unmap();
-
-    readWriteBalance++;
-
-    int rc = 0;
+    // grow the file by whole windows, the mapped windows stay valid
+    if (length + len > capacity)
+    {
+        const qint64 newCapacity = (length + len + WINDOW_SIZE - 1) / WINDOW_SIZE * WINDOW_SIZE;
+        if (ftruncate(ion, newCapacity) == 0)
+            capacity = newCapacity;
+        else
+            perror("HistoryFile::add.truncate");
+    }
 
-    rc = KDE_lseek(ion,length,SEEK_SET); if (rc < 0) { perror("HistoryFile::add.seek"); return; }
-    rc = write(ion,bytes,len);       if (rc < 0) { perror("HistoryFile::add.write"); return; }
+    int rc = pwrite(ion, bytes, len, length);
+    if (rc < 0) { perror("HistoryFile::add.write"); return; }
     length += rc;
 }
 
-void HistoryFile::get(unsigned char* bytes, int len, int loc)
+void HistoryFile::get(unsigned char* bytes, int len, qint64 loc)
 {
-    //count number of get() calls vs. number of add() calls.
-    //If there are many more get() calls compared with add()
-    //calls (decided by using MAP_THRESHOLD) then mmap the log
-    //file to improve performance.
-    readWriteBalance--;
-    if ( !fileMap && readWriteBalance < MAP_THRESHOLD )
-        map();
+    if (len <= 0)
+        return;
 
-    if ( fileMap )
+    // the callers do not check for errors, so whatever cannot be read
+    // is returned as zeros rather than left uninitialised
+    if (loc < 0 || loc + len > length)
     {
-        for (int i=0;i<len;i++)
-            bytes[i]=fileMap[loc+i];
+        fprintf(stderr,"getHist(...,%d,%lld): invalid args.\n",len,(long long)loc);
+        memset(bytes, 0, len);
+        return;
     }
-    else
+
+    // copy the data window by window
+    while (len > 0)
     {
-        int rc = 0;
+        const int offset = loc % WINDOW_SIZE;
+        const int count = qMin(len, WINDOW_SIZE - offset);
+
+        const char* window = mapWindow(loc / WINDOW_SIZE);
+        if (window)
+        {
+            memcpy(bytes, window + offset, count);
+        }
+        else
+        {
+            int rc = pread(ion, bytes, count, loc);
+            if (rc < 0) { perror("HistoryFile::get.read"); memset(bytes, 0, len); return; }
+            if (rc < count) memset(bytes + rc, 0, count - rc);
+        }
 
-        if (loc < 0 || len < 0 || loc + len > length)
-            fprintf(stderr,"getHist(...,%d,%d): invalid args.\n",len,loc);
-        rc = KDE_lseek(ion,loc,SEEK_SET); if (rc < 0) { perror("HistoryFile::get.seek"); return; }
-        rc = read(ion,bytes,len);     if (rc < 0) { perror("HistoryFile::get.read"); return; }
+        bytes += count;
+        loc += count;
+        len -= count;
     }
 }
 
-int HistoryFile::len()
+qint64 HistoryFile::len()
 {
     return length;
 }
@@ -227,7 +262,7 @@ HistoryScrollFile::~HistoryScrollFile()
 
 int HistoryScrollFile::getLines()
 {
-    return index.len() / sizeof(int);
+    return index.len() / sizeof(qint64);
 }
 
 int HistoryScrollFile::getLineLen(int lineno)
@@ -238,24 +273,20 @@ int HistoryScrollFile::getLineLen(int lineno)
 bool HistoryScrollFile::isWrappedLine(int lineno)
 {
     if (lineno>=0 && lineno <= getLines()) {
-        unsigned char flag;
+        unsigned char flag = 0;
         lineflags.get((unsigned char*)&flag,sizeof(unsigned char),(lineno)*sizeof(unsigned char));
         return flag;
     }
     return false;
 }
 
-int HistoryScrollFile::startOfLine(int lineno)
+qint64 HistoryScrollFile::startOfLine(int lineno)
 {
     if (lineno <= 0) return 0;
     if (lineno <= getLines())
     {
-
-        if (!index.isMapped())
-            index.map();
-
-        int res;
-        index.get((unsigned char*)&res,sizeof(int),(lineno-1)*sizeof(int));
+        qint64 res = 0;
+        index.get((unsigned char*)&res,sizeof(qint64),(lineno-1)*sizeof(qint64));
         return res;
     }
     return cells.len();
@@ -273,11 +304,8 @@ void HistoryScrollFile::addCells(const Character text[], int count)
 
 void HistoryScrollFile::addLine(bool previousWrapped)
 {
-    if (index.isMapped())
-        index.unmap();
-
-    int locn = cells.len();
-    index.add((unsigned char*)&locn,sizeof(int));
+    qint64 locn = cells.len();
+    index.add((unsigned char*)&locn,sizeof(qint64));
     unsigned char flags = previousWrapped ? 0x01 : 0x00;
     lineflags.add((unsigned char*)&flags,sizeof(unsigned char));
 }
@@ -555,12 +583,28 @@ void CompactHistoryBlock::deallocate ( )
     Q_ASSERT ( allocCount >= 0 );
 }
 
+// allocations are rounded up to keep the lines and their text aligned
+static inline size_t alignedSize(size_t size)
+{
+    return (size + 7) & ~size_t(7);
+}
+
 void* CompactHistoryBlockList::allocate(size_t size)
 {
+    size = alignedSize(size);
+
     CompactHistoryBlock* block;
     if ( list.isEmpty() || list.last()->remaining() < size)
     {
-        block = new CompactHistoryBlock();
+        if (spareBlock)
+        {
+            block = spareBlock;
+            spareBlock = 0;
+        }
+        else
+        {
+            block = new CompactHistoryBlock();
+        }
         list.append ( block );
         //kDebug() << "new block created, remaining " << block->remaining() << "number of blocks=" << list.size();
     }
@@ -569,37 +613,60 @@ void* CompactHistoryBlockList::allocate(size_t size)
         block = list.last();
         //kDebug() << "old block used, remaining " << block->remaining();
     }
+    usedBytes += size;
     return block->allocate(size);
 }
 
-void CompactHistoryBlockList::deallocate(void* ptr)
+void CompactHistoryBlockList::deallocate(void* ptr, size_t size)
 {
     Q_ASSERT( !list.isEmpty());
 
+    // lines are removed oldest first, so the block is usually the first one
     int i=0;
-    CompactHistoryBlock *block = list.at(i);
-    while ( i<list.size() && !block->contains(ptr) )
-    {
+    while ( i<list.size() && !list.at(i)->contains(ptr) )
         i++;
-        block=list.at(i);
-    }
 
     Q_ASSERT( i<list.size() );
 
+    CompactHistoryBlock *block = list.at(i);
     block->deallocate();
+    usedBytes -= alignedSize(size);
 
     if (!block->isInUse())
     {
         list.removeAt(i);
-        delete block;
+        if (spareBlock)
+        {
+            delete block;
+        }
+        else
+        {
+            block->reset();
+            spareBlock = block;
+        }
         //kDebug() << "block deleted, new size = " << list.size();
     }
 }
 
+CompactHistoryStatistics CompactHistoryBlockList::statistics() const
+{
+    CompactHistoryStatistics result;
+    result.blockCount = list.size();
+    result.spareBlockCount = spareBlock ? 1 : 0;
+    result.mappedBytes = 0;
+    foreach(CompactHistoryBlock* block, list)
+        result.mappedBytes += block->length();
+    if (spareBlock)
+        result.mappedBytes += spareBlock->length();
+    result.usedBytes = usedBytes;
+    return result;
+}
+
 CompactHistoryBlockList::~CompactHistoryBlockList()
 {
     qDeleteAll ( list.begin(), list.end() );
     list.clear();
+    delete spareBlock;
 }
 
 void* CompactHistoryLine::operator new (size_t size, CompactHistoryBlockList& blockList)
@@ -609,7 +676,8 @@ void* CompactHistoryLine::operator new (size_t size, CompactHistoryBlockList& bl
 
 CompactHistoryLine::CompactHistoryLine ( const TextLine& line, CompactHistoryBlockList& bList ) 
     : blockList(bList),
-      formatLength(0)
+      formatLength(0),
+      wideText(false)
 {
     length=line.size();
 
@@ -632,7 +700,9 @@ CompactHistoryLine::CompactHistoryLine ( const TextLine& line, CompactHistoryBlo
         //kDebug() << "number of different formats in string: " << formatLength;
         formatArray = (CharacterFormat*) blockList.allocate(sizeof(CharacterFormat)*formatLength);
         Q_ASSERT (formatArray!=NULL);
-        text = (quint16*) blockList.allocate(sizeof(quint16)*line.size());
+        for ( int i=0; i<line.size() && !wideText; i++ )
+            wideText = line[i].character > 0xFFFF;
+        text = blockList.allocate((wideText ? sizeof(quint32) : sizeof(quint16))*line.size());
         Q_ASSERT (text!=NULL);
 
         length=line.size();
@@ -660,10 +730,17 @@ CompactHistoryLine::CompactHistoryLine ( const TextLine& line, CompactHistoryBlo
         }
 
         // copy character values
-        for ( int i=0; i<line.size(); i++ )
+        if (wideText)
+        {
+            quint32* wide = static_cast<quint32*>(text);
+            for ( int i=0; i<line.size(); i++ )
+                wide[i]=line[i].character;
+        }
+        else
         {
-            text[i]=line[i].character;
-            //kDebug() << "char " << i << " at mem " << &(text[i]);
+            quint16* narrow = static_cast<quint16*>(text);
+            for ( int i=0; i<line.size(); i++ )
+                narrow[i]=line[i].character;
         }
     }
     //kDebug() << "line created, length " << length << " at " << &(length);
@@ -673,23 +750,38 @@ CompactHistoryLine::~CompactHistoryLine()
 {
     //kDebug() << "~CHL";
     if (length>0) {
-        blockList.deallocate(text);
-        blockList.deallocate(formatArray);
+        blockList.deallocate(text, (wideText ? sizeof(quint32) : sizeof(quint16))*length);
+        blockList.deallocate(formatArray, sizeof(CharacterFormat)*formatLength);
     }
-    blockList.deallocate(this);
+    blockList.deallocate(this, sizeof(CompactHistoryLine));
+}
+
+int CompactHistoryLine::formatIndex ( int index ) const
+{
+    // the format runs are sorted by their start position, find the last
+    // one which starts at or before 'index'
+    int first = 0;
+    int last = formatLength-1;
+    while ( first < last )
+    {
+        const int middle = ( first+last+1 ) / 2;
+        if ( formatArray[middle].startPos <= index )
+            first = middle;
+        else
+            last = middle-1;
+    }
+    return first;
 }
 
 void CompactHistoryLine::getCharacter ( int index, Character &r )
 {
     Q_ASSERT ( index < length );
-    int formatPos=0;
-    while ( ( formatPos+1 ) < formatLength && index >= formatArray[formatPos+1].startPos )
-        formatPos++;
+    const CharacterFormat& format = formatArray[formatIndex(index)];
 
-    r.character=text[index];
-    r.rendition = formatArray[formatPos].rendition;
-    r.foregroundColor = formatArray[formatPos].fgColor;
-    r.backgroundColor = formatArray[formatPos].bgColor;
+    r.character=characterAt(index);
+    r.rendition = format.rendition;
+    r.foregroundColor = format.fgColor;
+    r.backgroundColor = format.bgColor;
 }
 
 void CompactHistoryLine::getCharacters ( Character* array, int length, int startColumn )
@@ -697,15 +789,36 @@ void CompactHistoryLine::getCharacters ( Character* array, int length, int start
     Q_ASSERT ( startColumn >= 0 && length >= 0 );
     Q_ASSERT ( startColumn+length <= ( int ) getLength() );
 
-    for ( int i=startColumn; i<length+startColumn; i++ )
+    if ( length == 0 )
+        return;
+
+    // look up the run of the first column only, then fill the output one
+    // run at a time
+    const int endColumn = startColumn+length;
+    int formatPos = formatIndex ( startColumn );
+    int i = startColumn;
+    while ( i < endColumn )
     {
-        getCharacter ( i, array[i-startColumn] );
+        const CharacterFormat& format = formatArray[formatPos++];
+        const int runEnd = formatPos < formatLength
+                           ? qMin ( ( int ) formatArray[formatPos].startPos, endColumn )
+                           : endColumn;
+
+        for ( ; i < runEnd; i++ )
+        {
+            Character& r = array[i-startColumn];
+            r.character = characterAt(i);
+            r.rendition = format.rendition;
+            r.foregroundColor = format.fgColor;
+            r.backgroundColor = format.bgColor;
+        }
     }
 }
 
 CompactHistoryScroll::CompactHistoryScroll ( unsigned int maxLineCount )
     : HistoryScroll ( new CompactHistoryType ( maxLineCount ) )
     ,lines()
+    ,_head(0)
     ,blockList()
 {
     //kDebug() << "scroll of length " << maxLineCount << " created";
@@ -718,16 +831,35 @@ CompactHistoryScroll::~CompactHistoryScroll()
     lines.clear();
 }
 
+CompactHistoryLine* CompactHistoryScroll::lineAt ( int lineNumber ) const
+{
+    int index = _head + lineNumber;
+    if ( index >= lines.size() )
+        index -= lines.size();
+    return lines[index];
+}
+
 void CompactHistoryScroll::addCellsVector ( const TextLine& cells )
 {
     CompactHistoryLine *line;
     line = new(blockList) CompactHistoryLine ( cells, blockList );
 
-    if ( lines.size() > ( int ) _maxLineCount )
+    if ( lines.size() < ( int ) _maxLineCount )
     {
-        delete lines.takeAt ( 0 );
+        lines.append ( line );
+    }
+    else if ( !lines.isEmpty() )
+    {
+        // the history is full, the new line takes the place of the oldest one
+        delete lines[_head];
+        lines[_head] = line;
+        if ( ++_head == lines.size() )
+            _head = 0;
+    }
+    else
+    {
+        delete line;
     }
-    lines.append ( line );
 }
 
 void CompactHistoryScroll::addCells ( const Character a[], int count )
@@ -739,7 +871,10 @@ void CompactHistoryScroll::addCells ( const Character a[], int count )
 
 void CompactHistoryScroll::addLine ( bool previousWrapped )
 {
-    CompactHistoryLine *line = lines.last();
+    if ( lines.isEmpty() )
+        return;
+
+    CompactHistoryLine *line = lineAt ( lines.size()-1 );
     //kDebug() << "last line at address " << line;
     line->setWrapped(previousWrapped);
 }
@@ -752,7 +887,7 @@ int CompactHistoryScroll::getLines()
 int CompactHistoryScroll::getLineLen ( int lineNumber )
 {
     Q_ASSERT ( lineNumber >= 0 && lineNumber < lines.size() );
-    CompactHistoryLine* line = lines[lineNumber];
+    CompactHistoryLine* line = lineAt ( lineNumber );
     //kDebug() << "request for line at address " << line;
     return line->getLength();
 }
@@ -762,7 +897,7 @@ void CompactHistoryScroll::getCells ( int lineNumber, int startColumn, int count
 {
     if ( count == 0 ) return;
     Q_ASSERT ( lineNumber < lines.size() );
-    CompactHistoryLine* line = lines[lineNumber];
+    CompactHistoryLine* line = lineAt ( lineNumber );
     Q_ASSERT ( startColumn >= 0 );
     Q_ASSERT ( (unsigned int)startColumn <= line->getLength() - count );
     line->getCharacters ( buffer, count, startColumn );
@@ -770,18 +905,548 @@ void CompactHistoryScroll::getCells ( int lineNumber, int startColumn, int count
 
 void CompactHistoryScroll::setMaxNbLines ( unsigned int lineCount )
 {
-    _maxLineCount = lineCount;
+    // put the oldest line first again, so that the lines can be appended
+    // to until the new limit is reached
+    if ( _head != 0 )
+    {
+        std::rotate ( lines.begin(), lines.begin()+_head, lines.end() );
+        _head = 0;
+    }
 
-    while (lines.size() > (int) lineCount) {
-        delete lines.takeAt(0);
+    // drop the lines beyond the new limit in one go
+    const int excess = lines.size() - ( int ) lineCount;
+    if ( excess > 0 )
+    {
+        qDeleteAll ( lines.begin(), lines.begin()+excess );
+        lines.remove ( 0, excess );
     }
+
+    _maxLineCount = lineCount;
     //kDebug() << "set max lines to: " << _maxLineCount;
 }
 
+CompactHistoryStatistics CompactHistoryScroll::memoryStatistics() const
+{
+    return blockList.statistics();
+}
+
 bool CompactHistoryScroll::isWrappedLine ( int lineNumber )
 {
     Q_ASSERT ( lineNumber < lines.size() );
-    return lines[lineNumber]->isWrapped();
+    return lineAt ( lineNumber )->isWrapped();
+}
+
+
+////////////////////////////////////////////////////////////////
+// Compressed History Scroll ///////////////////////////////////
+////////////////////////////////////////////////////////////////
+CompressedHistoryScroll::CompressedHistoryScroll ( unsigned int uncompressedLineCount )
+    : HistoryScroll ( new CompressedHistoryType ( uncompressedLineCount ) )
+    ,_uncompressedLineCount ( qMax ( uncompressedLineCount, 1u ) )
+    ,_decodedFrames ( CachedFrames )
+{
+}
+
+CompressedHistoryScroll::~CompressedHistoryScroll()
+{
+}
+
+void CompressedHistoryScroll::addCellsVector ( const QVector<Character>& cells )
+{
+    UncompressedLine line;
+    line.cells = cells;
+    line.wrapped = false;
+    _lines.append ( line );
+
+    if ( _lines.size() >= ( int ) _uncompressedLineCount + FrameLines )
+        compressFrame();
+}
+
+void CompressedHistoryScroll::addCells ( const Character a[], int count )
+{
+    QVector<Character> newLine ( count );
+    qCopy ( a,a+count,newLine.begin() );
+    addCellsVector ( newLine );
+}
+
+void CompressedHistoryScroll::addLine ( bool previousWrapped )
+{
+    if ( !_lines.isEmpty() )
+        _lines.last().wrapped = previousWrapped;
+}
+
+void CompressedHistoryScroll::compressFrame()
+{
+    int cellCount = 0;
+    for ( int i = 0; i < FrameLines; i++ )
+        cellCount += _lines.at(i).cells.size();
+
+    QByteArray cells;
+    cells.reserve ( cellCount*sizeof(Character) );
+    for ( int i = 0; i < FrameLines; i++ )
+    {
+        const UncompressedLine& line = _lines.first();
+        cells.append ( reinterpret_cast<const char*>( line.cells.constData() ),
+                       line.cells.size()*sizeof(Character) );
+        _compressedLines.append ( line.cells.size() | ( line.wrapped ? WrappedLine : 0 ) );
+        _lines.removeFirst();
+    }
+
+    // the frame is only compressed once but may never be read again,
+    // so favour speed over size
+    _frames.append ( qCompress ( cells, 1 ) );
+}
+
+const CompressedHistoryScroll::DecodedFrame* CompressedHistoryScroll::decodedFrame ( int frame )
+{
+    DecodedFrame* decoded = _decodedFrames.object ( frame );
+    if ( decoded )
+        return decoded;
+
+    decoded = new DecodedFrame;
+    decoded->lineStart.resize ( FrameLines );
+    int start = 0;
+    for ( int i = 0; i < FrameLines; i++ )
+    {
+        decoded->lineStart[i] = start;
+        start += _compressedLines.at ( frame*FrameLines+i ) & ~WrappedLine;
+    }
+
+    decoded->cells = qUncompress ( _frames.at ( frame ) );
+    if ( decoded->cells.size() != start*( int ) sizeof(Character) )
+    {
+        qWarning() << "CompressedHistoryScroll: frame" << frame << "cannot be decompressed";
+        delete decoded;
+        return 0;
+    }
+
+    _decodedFrames.insert ( frame, decoded );
+    return decoded;
+}
+
+int CompressedHistoryScroll::getLines()
+{
+    return _compressedLines.size() + _lines.size();
+}
+
+int CompressedHistoryScroll::getLineLen ( int lineno )
+{
+    Q_ASSERT ( lineno >= 0 && lineno < getLines() );
+    if ( lineno < _compressedLines.size() )
+        return _compressedLines.at ( lineno ) & ~WrappedLine;
+    return _lines.at ( lineno-_compressedLines.size() ).cells.size();
+}
+
+bool CompressedHistoryScroll::isWrappedLine ( int lineno )
+{
+    Q_ASSERT ( lineno >= 0 && lineno < getLines() );
+    if ( lineno < _compressedLines.size() )
+        return _compressedLines.at ( lineno ) & WrappedLine;
+    return _lines.at ( lineno-_compressedLines.size() ).wrapped;
+}
+
+void CompressedHistoryScroll::getCells ( int lineno, int colno, int count, Character res[] )
+{
+    if ( count == 0 ) return;
+    Q_ASSERT ( lineno >= 0 && lineno < getLines() );
+    Q_ASSERT ( colno >= 0 && colno+count <= getLineLen ( lineno ) );
+
+    if ( lineno >= _compressedLines.size() )
+    {
+        const QVector<Character>& cells = _lines.at ( lineno-_compressedLines.size() ).cells;
+        qCopy ( cells.constBegin()+colno, cells.constBegin()+colno+count, res );
+        return;
+    }
+
+    const DecodedFrame* frame = decodedFrame ( lineno / FrameLines );
+    if ( !frame )
+    {
+        for ( int i = 0; i < count; i++ )
+            res[i] = Character();
+        return;
+    }
+
+    const int start = frame->lineStart.at ( lineno % FrameLines ) + colno;
+    memcpy ( res, frame->cells.constData() + start*sizeof(Character), count*sizeof(Character) );
+}
+
+
+////////////////////////////////////////////////////////////////
+// Reflowing History Scroll ////////////////////////////////////
+////////////////////////////////////////////////////////////////
+HistoryScrollReflow::HistoryScrollReflow(HistoryScroll* source)
+    : HistoryScroll(0),
+      _source(source),
+      _columns(0),
+      _reflow(false),
+      _head(0),
+      _lastWrapped(false),
+      _pendingLines(-1),
+      _pendingLength(0),
+      _sourceBase(0),
+      _wrapSource(0),
+      _wrapLines(0),
+      _wrapOpen(false),
+      _wrapOpenLength(0),
+      _layoutValid(true),
+      _firstRow(0),
+      _endRow(0)
+{
+    rebuild();
+}
+
+HistoryScrollReflow::~HistoryScrollReflow()
+{
+    delete _source;
+}
+
+HistoryScroll* HistoryScrollReflow::source() const
+{
+    return _source;
+}
+
+HistoryScroll* HistoryScrollReflow::setSource(HistoryScroll* source)
+{
+    HistoryScroll* previous = _source;
+    _source = source;
+    rebuild();
+    return previous;
+}
+
+void HistoryScrollReflow::setColumns(int columns)
+{
+    if (columns == _columns)
+        return;
+
+    _columns = columns;
+    wrapAll();
+}
+
+qint64 HistoryScrollReflow::firstSourceLine() const
+{
+    return _sourceBase;
+}
+
+qint64 HistoryScrollReflow::endSourceLine()
+{
+    return _sourceBase + _source->getLines();
+}
+
+void HistoryScrollReflow::rebuild()
+{
+    _logical.clear();
+    _head = 0;
+    _lastWrapped = false;
+    _pendingLines = -1;
+    _pendingLength = 0;
+    _sourceBase = 0;
+
+    // the lines of the other histories are passed through, see the class
+    // documentation
+    _reflow = dynamic_cast<CompactHistoryScroll*>(_source) ||
+              dynamic_cast<HistoryScrollBuffer*>(_source);
+    if (!_reflow)
+    {
+        _logical.squeeze();
+        wrapAll();
+        return;
+    }
+
+    const int lines = _source->getLines();
+    for (int i = 0; i < lines; i++)
+    {
+        const int length = _source->getLineLen(i);
+        if (_lastWrapped)
+        {
+            _logical.last().sourceLines++;
+            _logical.last().length += length;
+        }
+        else
+        {
+            LogicalLine line = { i, 1, length, length, 0 };
+            _logical.append(line);
+        }
+        _lastWrapped = _source->isWrappedLine(i);
+    }
+
+    // the lines may have been written at any width
+    wrapAll();
+}
+
+void HistoryScrollReflow::wrapAll()
+{
+    _wrapSource = _sourceBase + _source->getLines();
+    _wrapLines = (_columns > 0) ? _logical.size() - _head : 0;
+    _wrapOpen = (_wrapLines > 0 && _lastWrapped);
+    _wrapOpenLength = _wrapOpen ? _logical.last().length : 0;
+
+    // the rows are only counted when the history is read next, so that
+    // resizing the screen repeatedly does not go through the history
+    // every time
+    _layoutValid = false;
+}
+
+void HistoryScrollReflow::updateLayout()
+{
+    if (_layoutValid)
+        return;
+
+    qint64 row = 0;
+    for (int i = _head; i < _head + _wrapLines; i++)
+    {
+        _logical[i].firstRow = row;
+        row += rowCount(i);
+    }
+
+    _firstRow = 0;
+    _endRow = row;
+    _layoutValid = true;
+}
+
+int HistoryScrollReflow::wrappedLength(int index) const
+{
+    if (_wrapOpen && index == _head + _wrapLines - 1)
+        return _wrapOpenLength;
+    return _logical.at(index).length;
+}
+
+int HistoryScrollReflow::rowCount(int index) const
+{
+    return qMax(1, (wrappedLength(index) + _columns - 1) / _columns);
+}
+
+int HistoryScrollReflow::findLogicalLine(int row) const
+{
+    // the last of the wrapped logical lines which starts at or before 'row'
+    int first = _head;
+    int last = _head + _wrapLines - 1;
+    const qint64 absoluteRow = _firstRow + row;
+    while (first < last)
+    {
+        const int middle = (first + last + 1) / 2;
+        if (_logical.at(middle).firstRow <= absoluteRow)
+            first = middle;
+        else
+            last = middle - 1;
+    }
+    return first;
+}
+
+int HistoryScrollReflow::sourceLine(int lineno)
+{
+    updateLayout();
+
+    const int wrappedRows = _endRow - _firstRow;
+    if (lineno < wrappedRows)
+        return -1;
+    return qMax(_wrapSource, _sourceBase) - _sourceBase + lineno - wrappedRows;
+}
+
+bool HistoryScrollReflow::hasScroll()
+{
+    return _source->hasScroll();
+}
+
+const HistoryType& HistoryScrollReflow::getType()
+{
+    // this scroll has no type of its own
+    return _source->getType();
+}
+
+int HistoryScrollReflow::getLines()
+{
+    if (_wrapLines == 0)
+        return _source->getLines();
+
+    updateLayout();
+    return (_endRow - _firstRow) +
+           (_sourceBase + _source->getLines() - qMax(_wrapSource, _sourceBase));
+}
+
+int HistoryScrollReflow::getLineLen(int lineno)
+{
+    if (_wrapLines == 0)
+        return _source->getLineLen(lineno);
+
+    const int line = sourceLine(lineno);
+    if (line >= 0)
+        return _source->getLineLen(line);
+
+    const int index = findLogicalLine(lineno);
+    const int offset = (_firstRow + lineno - _logical.at(index).firstRow) * _columns;
+    return qBound(0, wrappedLength(index) - offset, _columns);
+}
+
+bool HistoryScrollReflow::isWrappedLine(int lineno)
+{
+    if (_wrapLines == 0)
+        return _source->isWrappedLine(lineno);
+
+    const int line = sourceLine(lineno);
+    if (line >= 0)
+        return _source->isWrappedLine(line);
+
+    // the last row of a logical line is only wrapped if the line goes on
+    // after the wrapped lines
+    const int index = findLogicalLine(lineno);
+    const int row = _firstRow + lineno - _logical.at(index).firstRow;
+    return row < rowCount(index) - 1 ||
+           (_wrapOpen && index == _head + _wrapLines - 1);
+}
+
+void HistoryScrollReflow::getCells(int lineno, int colno, int count, Character res[])
+{
+    if (_wrapLines == 0 || count == 0)
+    {
+        _source->getCells(lineno, colno, count, res);
+        return;
+    }
+
+    const int line = sourceLine(lineno);
+    if (line >= 0)
+    {
+        _source->getCells(line, colno, count, res);
+        return;
+    }
+
+    // copy the characters out of the source lines which the row was split from
+    const int index = findLogicalLine(lineno);
+    const LogicalLine& logical = _logical.at(index);
+    int skip = (_firstRow + lineno - logical.firstRow) * _columns + colno;
+    const int first = logical.firstSource - _sourceBase;
+    for (int i = first; i < first + logical.sourceLines && count > 0; i++)
+    {
+        const int length = _source->getLineLen(i);
+        if (skip >= length)
+        {
+            skip -= length;
+            continue;
+        }
+
+        const int n = qMin(length - skip, count);
+        _source->getCells(i, skip, n, res);
+        res += n;
+        count -= n;
+        skip = 0;
+    }
+}
+
+void HistoryScrollReflow::addCells(const Character a[], int count)
+{
+    if (_pendingLines < 0)
+        _pendingLines = _source->getLines();
+    _pendingLength += count;
+
+    _source->addCells(a, count);
+}
+
+void HistoryScrollReflow::addCellsVector(const QVector<Character>& cells)
+{
+    if (_pendingLines < 0)
+        _pendingLines = _source->getLines();
+    _pendingLength += cells.size();
+
+    _source->addCellsVector(cells);
+}
+
+void HistoryScrollReflow::addLine(bool previousWrapped)
+{
+    const int linesBefore = (_pendingLines < 0) ? _source->getLines() : _pendingLines;
+    const int length = _pendingLength;
+    _pendingLines = -1;
+    _pendingLength = 0;
+
+    _source->addLine(previousWrapped);
+
+    const int lines = _source->getLines();
+    if (lines == 0)
+        return;
+    if (lines != linesBefore + 1 && lines != linesBefore)
+    {
+        // the source did something other than adding a line
+        rebuild();
+        return;
+    }
+
+    if (!_reflow)
+    {
+        if (lines == linesBefore)
+            _sourceBase++;
+        return;
+    }
+
+    // the new line is passed through, see setColumns()
+    if (_lastWrapped && _head < _logical.size())
+    {
+        _logical.last().sourceLines++;
+        _logical.last().length += length;
+    }
+    else
+    {
+        LogicalLine line = { _sourceBase + linesBefore, 1, length, length, 0 };
+        _logical.append(line);
+    }
+    _lastWrapped = previousWrapped;
+
+    // if the source is full, its oldest line made room for the new one
+    if (lines == linesBefore)
+        dropFirstSourceLine();
+}
+
+void HistoryScrollReflow::dropFirstSourceLine()
+{
+    _sourceBase++;
+
+    LogicalLine& first = _logical[_head];
+    const bool wrapped = (_wrapLines > 0);
+    const bool layout = wrapped && _layoutValid;
+    const qint64 endRow = layout ? first.firstRow + rowCount(_head) : 0;
+
+    const bool removed = (first.sourceLines == 1);
+    if (removed)
+    {
+        _head++;
+        if (wrapped && --_wrapLines == 0)
+            _wrapOpen = false;
+    }
+    else
+    {
+        if (wrapped && _wrapOpen && _wrapLines == 1)
+            _wrapOpenLength -= first.firstLength;
+
+        first.firstSource++;
+        first.sourceLines--;
+        first.length -= first.firstLength;
+        first.firstLength = (first.sourceLines == 1) ? first.length : _source->getLineLen(0);
+
+        if (wrapped && first.firstSource >= _wrapSource)
+        {
+            // none of the line's wrapped part is left
+            _wrapLines = 0;
+            _wrapOpen = false;
+        }
+    }
+
+    // the rows after the first logical line keep their numbers, the first
+    // line now ends where it did before
+    if (layout)
+    {
+        if (!removed && _wrapLines > 0)
+        {
+            first.firstRow = endRow - rowCount(_head);
+            _firstRow = first.firstRow;
+        }
+        else
+        {
+            _firstRow = endRow;
+        }
+    }
+
+    if (_head >= 1024 && _head * 2 >= _logical.size())
+    {
+        _logical.remove(0, _head);
+        _head = 0;
+    }
 }
 
 
@@ -987,3 +1652,52 @@ HistoryScroll* CompactHistoryType::scroll ( HistoryScroll *old ) const
     }
     return new CompactHistoryScroll ( m_nbLines );
 }
+
+//////////////////////////////
+
+CompressedHistoryType::CompressedHistoryType ( unsigned int uncompressedLines )
+    : m_uncompressedLines ( uncompressedLines )
+{
+}
+
+bool CompressedHistoryType::isEnabled() const
+{
+    return true;
+}
+
+int CompressedHistoryType::maximumLineCount() const
+{
+    return 0;
+}
+
+HistoryScroll* CompressedHistoryType::scroll ( HistoryScroll *old ) const
+{
+    if ( dynamic_cast<CompressedHistoryScroll*> ( old ) )
+        return old; // Unchanged.
+
+    HistoryScroll *newScroll = new CompressedHistoryScroll ( m_uncompressedLines );
+
+    Character line[LINE_SIZE];
+    int lines = ( old != 0 ) ? old->getLines() : 0;
+    for ( int i = 0; i < lines; i++ )
+    {
+        int size = old->getLineLen ( i );
+        if ( size > LINE_SIZE )
+        {
+            Character *tmp_line = new Character[size];
+            old->getCells ( i, 0, size, tmp_line );
+            newScroll->addCells ( tmp_line, size );
+            newScroll->addLine ( old->isWrappedLine ( i ) );
+            delete [] tmp_line;
+        }
+        else
+        {
+            old->getCells ( i, 0, size, line );
+            newScroll->addCells ( line, size );
+            newScroll->addLine ( old->isWrappedLine ( i ) );
+        }
+    }
+
+    delete old;
+    return newScroll;
+}
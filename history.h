@@ -36,43 +36,56 @@
 
 // Qt
 #include <QBitRef>
+#include <QCache>
 #include <QHash>
+#include <QList>
 #include <QVector>
 #include <QTemporaryFile>
 
+/**
+ * A temporary file which can only be appended to but read anywhere.
+ *
+ * The file is read through read-only memory mappings of fixed-size windows,
+ * which are mapped when they are first read from and kept in a small cache,
+ * so reading the history does not map more than a few megabytes of even a
+ * very large file.  The file grows a whole window at a time, so that every
+ * window which holds data lies within the file and can be mapped, and
+ * appending to the file never invalidates the windows which are mapped.
+ */
 class HistoryFile {
 public:
     HistoryFile();
     virtual ~HistoryFile();
 
     virtual void add(const unsigned char* bytes, int len);
-    virtual void get(unsigned char* bytes, int len, int loc);
-    virtual int  len();
+    virtual void get(unsigned char* bytes, int len, qint64 loc);
+    virtual qint64 len();
+
+private:
+    // size of a mapped window, which is also the unit the file grows by
+    static const int WINDOW_SIZE = 1 << 20;
+    // number of windows which are kept mapped
+    static const int WINDOW_COUNT = 4;
 
-    //mmaps the file in read-only mode
-    void map();
-    //un-mmaps the file
-    void unmap();
-    //returns true if the file is mmap'ed
-    bool isMapped();
+    struct MappedWindow
+    {
+        qint64 index;
+        char* data;
+        quint64 lastUse;
+    };
 
+    // returns the mapping of window 'window', mapping it in place of the
+    // least recently used window if necessary, or 0 if it cannot be mapped
+    const char* mapWindow(qint64 window);
 
-private:
     int  ion;
-    int  length;
+    qint64 length;
+    // size of the file, which is rounded up to whole windows
+    qint64 capacity;
     QTemporaryFile tmpFile;
 
-    //pointer to start of mmap'ed file data, or 0 if the file is not mmap'ed
-    char* fileMap;
-
-    //incremented whenver 'add' is called and decremented whenever
-    //'get' is called.
-    //this is used to detect when a large number of lines are being read and processed from the history
-    //and automatically mmap the file for better performance (saves the overhead of many lseek-read calls).
-    int readWriteBalance;
-
-    //when readWriteBalance goes below this threshold, the file will be mmap'ed automatically
-    static const int MAP_THRESHOLD = -1000;
+    MappedWindow windows[WINDOW_COUNT];
+    quint64 useCount;
 };
 
 
@@ -116,7 +129,7 @@ public:
     // is very unsafe, because those references will no longer
     // be valid if the history scroll is deleted.
     //
-    const HistoryType& getType() { return *m_histType; }
+    virtual const HistoryType& getType() { return *m_histType; }
 
 protected:
     HistoryType* m_histType;
@@ -142,10 +155,10 @@ public:
     virtual void addLine(bool previousWrapped=false);
 
 private:
-    int startOfLine(int lineno);
+    qint64 startOfLine(int lineno);
 
     QString m_logFileName;
-    HistoryFile index; // lines Row(int)
+    HistoryFile index; // lines Row(qint64)
     HistoryFile cells; // text  Row(Character)
     HistoryFile lineflags; // flags Row(unsigned char)
 };
@@ -280,6 +293,8 @@ public:
     virtual bool contains(void *addr) {return addr>=blockStart && addr<(blockStart+blockLength);}
     virtual void deallocate();
     virtual bool isInUse(){ return allocCount!=0; } ;
+    // makes the whole block available again, it must not be in use
+    void reset() { tail = blockStart; allocCount = 0; }
 
 private:
     size_t blockLength;
@@ -289,16 +304,37 @@ private:
     int allocCount;
 };
 
+/**
+ * Memory used by a CompactHistoryScroll.  The difference between
+ * mappedBytes and usedBytes is memory which is held by the blocks but no
+ * longer used by lines in the history.
+ */
+struct CompactHistoryStatistics
+{
+    int blockCount;        // blocks holding lines
+    int spareBlockCount;   // emptied blocks kept for reuse
+    size_t mappedBytes;    // memory mapped for all blocks
+    size_t usedBytes;      // memory taken by the lines in the history
+};
+
 class CompactHistoryBlockList {
 public:
-    CompactHistoryBlockList() {};
+    CompactHistoryBlockList() : spareBlock(0), usedBytes(0) {};
     ~CompactHistoryBlockList();
 
     void *allocate( size_t size );
-    void deallocate(void *);
+    // 'size' is the size which was passed to allocate()
+    void deallocate(void *, size_t size);
     int length() {return list.size();}
+    CompactHistoryStatistics statistics() const;
 private:
     QList<CompactHistoryBlock*> list;
+    // a block which has been emptied is kept for the next allocation which
+    // does not fit into the last block, so that a full history, which keeps
+    // replacing its oldest lines, does not map and unmap a block every few
+    // thousand lines
+    CompactHistoryBlock* spareBlock;
+    size_t usedBytes;
 };
 
 class CompactHistoryLine
@@ -318,17 +354,29 @@ public:
     virtual unsigned int getLength() const {return length;};
 
 protected:
+    // returns the index of the format run which contains column 'index'
+    int formatIndex(int index) const;
+
+    // returns the code point stored at 'index'
+    uint characterAt(int index) const
+    { return wideText ? static_cast<const quint32*>(text)[index]
+                      : static_cast<const quint16*>(text)[index]; }
+
     CompactHistoryBlockList& blockList;
     CharacterFormat* formatArray;
     quint16 length;
-    quint16* text;
+    // the code points of the line, stored as quint16 values unless the line
+    // contains characters beyond the basic multilingual plane, in which case
+    // 'wideText' is set and quint32 values are used instead
+    void* text;
     quint16 formatLength;
     bool wrapped;
+    bool wideText;
 };
 
 class CompactHistoryScroll : public HistoryScroll
 {
-    typedef QList<CompactHistoryLine*> HistoryArray;
+    typedef QVector<CompactHistoryLine*> HistoryArray;
 
 public:
     CompactHistoryScroll(unsigned int maxNbLines = 1000);
@@ -346,14 +394,215 @@ public:
     void setMaxNbLines(unsigned int nbLines);
     unsigned int maxNbLines() const { return _maxLineCount; }
 
+    /** Returns the memory used by the history, to watch its fragmentation. */
+    CompactHistoryStatistics memoryStatistics() const;
+
 private:
     bool hasDifferentColors(const TextLine& line) const;
+    // returns the line 'lineNumber', where 0 is the oldest line
+    CompactHistoryLine* lineAt(int lineNumber) const;
+
+    // the lines are appended until there are '_maxLineCount' of them, from
+    // then on they form a ring starting at '_head' in which each new line
+    // replaces the oldest one
     HistoryArray lines;
+    int _head;
     CompactHistoryBlockList blockList;
 
     unsigned int _maxLineCount;
 };
 
+//////////////////////////////////////////////////////////////////////
+// History which keeps older lines compressed (no limitation in length)
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * An unlimited history which is kept in memory.
+ *
+ * The most recent lines are kept as they are.  Older lines are packed into
+ * frames of FrameLines lines each, whose characters are compressed together
+ * with qCompress().  Every frame can be decompressed on its own.  The
+ * lengths of the compressed lines are kept in an uncompressed index, so
+ * getLineLen() and isWrappedLine() never decompress anything and getCells()
+ * only decompresses the frame which contains the line.  The last few
+ * decompressed frames are cached, so scrolling through the history
+ * decompresses each frame once.
+ */
+class CompressedHistoryScroll : public HistoryScroll
+{
+public:
+    CompressedHistoryScroll(unsigned int uncompressedLineCount = 1000);
+    virtual ~CompressedHistoryScroll();
+
+    virtual int  getLines();
+    virtual int  getLineLen(int lineno);
+    virtual void getCells(int lineno, int colno, int count, Character res[]);
+    virtual bool isWrappedLine(int lineno);
+
+    virtual void addCells(const Character a[], int count);
+    virtual void addCellsVector(const QVector<Character>& cells);
+    virtual void addLine(bool previousWrapped=false);
+
+private:
+    // number of lines which are compressed together
+    enum { FrameLines = 256 };
+    // number of decompressed frames which are cached
+    enum { CachedFrames = 4 };
+    // set in the index for compressed lines which are wrapped
+    enum { WrappedLine = 0x80000000 };
+
+    struct UncompressedLine
+    {
+        QVector<Character> cells;
+        bool wrapped;
+    };
+
+    struct DecodedFrame
+    {
+        QByteArray cells;           // the characters of all lines in the frame
+        QVector<int> lineStart;     // the index of the first character of each line
+    };
+
+    // compresses the oldest FrameLines uncompressed lines into a new frame
+    void compressFrame();
+    // returns the decompressed frame 'frame' or 0 if it cannot be decompressed
+    const DecodedFrame* decodedFrame(int frame);
+
+    unsigned int _uncompressedLineCount;
+
+    QVector<QByteArray> _frames;
+    QVector<quint32> _compressedLines;  // length and WrappedLine flag of each compressed line
+    QCache<int,DecodedFrame> _decodedFrames;
+
+    // the most recent lines, which come after the compressed ones
+    QList<UncompressedLine> _lines;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Reflowing view onto another history
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * Presents the lines of another history scroll wrapped at a given width.
+ *
+ * The source keeps its lines as they were written.  This scroll only keeps
+ * the length of every logical line, ie. every run of lines which ends with
+ * a line that is not wrapped, and the source lines it is made of.  When the
+ * width changes with setColumns(), the lines which are in the source at
+ * that time are split again at the new width the next time the history is
+ * read, which only needs the lengths.  The characters of a line are copied
+ * out of the source lines it was split from when they are read.
+ *
+ * Lines which are added after setColumns() are expected to be written at
+ * the new width already and are passed through unchanged, so adding a line
+ * always adds exactly one line, less the lines which are dropped from the
+ * start of the history if the source is full.
+ *
+ * Only the histories which keep a limited number of lines in memory
+ * (CompactHistoryScroll and HistoryScrollBuffer) are reflowed.  The others
+ * are meant to keep long histories out of memory, which an entry for every
+ * logical line would defeat, and reading all their lines whenever the
+ * source is set would be slow, so their lines are always passed through.
+ */
+class HistoryScrollReflow : public HistoryScroll
+{
+public:
+    /** Constructs a view onto @p source, which it takes ownership of. */
+    HistoryScrollReflow(HistoryScroll* source);
+    virtual ~HistoryScrollReflow();
+
+    /** Returns the history which this view reads from. */
+    HistoryScroll* source() const;
+    /**
+     * Replaces the history which this view reads from with @p source and
+     * returns the previous one, which the caller takes ownership of.
+     */
+    HistoryScroll* setSource(HistoryScroll* source);
+
+    /**
+     * Wraps the lines which are currently in the history at @p columns
+     * columns, or leaves the lines as they are in the source if @p columns
+     * is 0.
+     */
+    void setColumns(int columns);
+
+    /**
+     * Returns the number of the first line in the source, counting the lines
+     * which have been added since the source was set, including those which
+     * have been dropped since.
+     */
+    qint64 firstSourceLine() const;
+    /** Returns the number of the line which the source will add next, see firstSourceLine() */
+    qint64 endSourceLine();
+
+    virtual bool hasScroll();
+    virtual const HistoryType& getType();
+
+    virtual int  getLines();
+    virtual int  getLineLen(int lineno);
+    virtual void getCells(int lineno, int colno, int count, Character res[]);
+    virtual bool isWrappedLine(int lineno);
+
+    virtual void addCells(const Character a[], int count);
+    virtual void addCellsVector(const QVector<Character>& cells);
+    virtual void addLine(bool previousWrapped=false);
+
+private:
+    struct LogicalLine
+    {
+        qint64 firstSource; // source line number, counted from the first line ever added
+        int sourceLines;
+        int length;         // the total length of the source lines
+        int firstLength;    // the length of the first source line
+        qint64 firstRow;    // see updateLayout()
+    };
+
+    // reads the logical lines from the source again
+    void rebuild();
+    // wraps all the lines which are in the source at _columns
+    void wrapAll();
+    // removes the first line of the source from the logical lines
+    void dropFirstSourceLine();
+    // numbers the rows of the lines which are wrapped at _columns
+    void updateLayout();
+    // returns the number of rows which the wrapped logical line 'index' takes up
+    int rowCount(int index) const;
+    // returns the length of the wrapped part of the logical line 'index'
+    int wrappedLength(int index) const;
+    // returns the logical line which contains wrapped row 'row'
+    int findLogicalLine(int row) const;
+    // returns the source line for 'lineno' if that line is passed through,
+    // or -1 if it is a wrapped row
+    int sourceLine(int lineno);
+
+    HistoryScroll* _source;
+    int _columns;
+    bool _reflow;          // whether the source is reflowed at all, see rebuild()
+
+    // the logical lines, starting at _head
+    QVector<LogicalLine> _logical;
+    int _head;
+    bool _lastWrapped;     // the last source line continues on the next one
+    int _pendingLines;     // the number of source lines before the line being added, or -1
+    int _pendingLength;    // the cells added to the line being added
+    qint64 _sourceBase;    // the number of source lines dropped so far
+
+    // the source lines before _wrapSource are wrapped at _columns, the
+    // first _wrapLines logical lines are (partly) among them.  If the last of
+    // those continues past _wrapSource, only its first _wrapOpenLength
+    // characters are wrapped
+    qint64 _wrapSource;
+    int _wrapLines;
+    bool _wrapOpen;
+    int _wrapOpenLength;
+
+    // the rows which the wrapped logical lines take up, numbered from the
+    // first row ever laid out
+    bool _layoutValid;
+    qint64 _firstRow;
+    qint64 _endRow;
+};
+
 //////////////////////////////////////////////////////////////////////
 // History type
 //////////////////////////////////////////////////////////////////////
@@ -451,3 +700,17 @@ public:
 protected:
     unsigned int m_nbLines;
 };
+
+class CompressedHistoryType : public HistoryType
+{
+public:
+    CompressedHistoryType(unsigned int uncompressedLines);
+
+    virtual bool isEnabled() const;
+    virtual int maximumLineCount() const;
+
+    virtual HistoryScroll* scroll(HistoryScroll *) const;
+
+protected:
+    unsigned int m_uncompressedLines;
+};
@@ -21,12 +21,74 @@
 #include <QString>
 
 struct interval {
-    unsigned short first;
-    unsigned short last;
+    uint first;
+    uint last;
+};
+
+/* sorted list of non-overlapping intervals of non-spacing characters */
+static constexpr interval combining[] = {
+    { 0x0300, 0x034E }, { 0x0360, 0x0362 }, { 0x0483, 0x0486 },
+    { 0x0488, 0x0489 }, { 0x0591, 0x05A1 }, { 0x05A3, 0x05B9 },
+    { 0x05BB, 0x05BD }, { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 },
+    { 0x05C4, 0x05C4 }, { 0x064B, 0x0655 }, { 0x0670, 0x0670 },
+    { 0x06D6, 0x06E4 }, { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED },
+    { 0x070F, 0x070F }, { 0x0711, 0x0711 }, { 0x0730, 0x074A },
+    { 0x07A6, 0x07B0 }, { 0x0901, 0x0902 }, { 0x093C, 0x093C },
+    { 0x0941, 0x0948 }, { 0x094D, 0x094D }, { 0x0951, 0x0954 },
+    { 0x0962, 0x0963 }, { 0x0981, 0x0981 }, { 0x09BC, 0x09BC },
+    { 0x09C1, 0x09C4 }, { 0x09CD, 0x09CD }, { 0x09E2, 0x09E3 },
+    { 0x0A02, 0x0A02 }, { 0x0A3C, 0x0A3C }, { 0x0A41, 0x0A42 },
+    { 0x0A47, 0x0A48 }, { 0x0A4B, 0x0A4D }, { 0x0A70, 0x0A71 },
+    { 0x0A81, 0x0A82 }, { 0x0ABC, 0x0ABC }, { 0x0AC1, 0x0AC5 },
+    { 0x0AC7, 0x0AC8 }, { 0x0ACD, 0x0ACD }, { 0x0B01, 0x0B01 },
+    { 0x0B3C, 0x0B3C }, { 0x0B3F, 0x0B3F }, { 0x0B41, 0x0B43 },
+    { 0x0B4D, 0x0B4D }, { 0x0B56, 0x0B56 }, { 0x0B82, 0x0B82 },
+    { 0x0BC0, 0x0BC0 }, { 0x0BCD, 0x0BCD }, { 0x0C3E, 0x0C40 },
+    { 0x0C46, 0x0C48 }, { 0x0C4A, 0x0C4D }, { 0x0C55, 0x0C56 },
+    { 0x0CBF, 0x0CBF }, { 0x0CC6, 0x0CC6 }, { 0x0CCC, 0x0CCD },
+    { 0x0D41, 0x0D43 }, { 0x0D4D, 0x0D4D }, { 0x0DCA, 0x0DCA },
+    { 0x0DD2, 0x0DD4 }, { 0x0DD6, 0x0DD6 }, { 0x0E31, 0x0E31 },
+    { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E }, { 0x0EB1, 0x0EB1 },
+    { 0x0EB4, 0x0EB9 }, { 0x0EBB, 0x0EBC }, { 0x0EC8, 0x0ECD },
+    { 0x0F18, 0x0F19 }, { 0x0F35, 0x0F35 }, { 0x0F37, 0x0F37 },
+    { 0x0F39, 0x0F39 }, { 0x0F71, 0x0F7E }, { 0x0F80, 0x0F84 },
+    { 0x0F86, 0x0F87 }, { 0x0F90, 0x0F97 }, { 0x0F99, 0x0FBC },
+    { 0x0FC6, 0x0FC6 }, { 0x102D, 0x1030 }, { 0x1032, 0x1032 },
+    { 0x1036, 0x1037 }, { 0x1039, 0x1039 }, { 0x1058, 0x1059 },
+    { 0x1160, 0x11FF }, { 0x17B7, 0x17BD }, { 0x17C6, 0x17C6 },
+    { 0x17C9, 0x17D3 }, { 0x180B, 0x180E }, { 0x18A9, 0x18A9 },
+    { 0x200B, 0x200F }, { 0x202A, 0x202E }, { 0x206A, 0x206F },
+    { 0x20D0, 0x20E3 }, { 0x302A, 0x302F }, { 0x3099, 0x309A },
+    { 0xFB1E, 0xFB1E }, { 0xFE20, 0xFE23 }, { 0xFEFF, 0xFEFF },
+    { 0xFFF9, 0xFFFB }, { 0x1D167, 0x1D169 }, { 0x1D173, 0x1D182 },
+    { 0x1D185, 0x1D18B }, { 0x1D1AA, 0x1D1AD }, { 0xE0001, 0xE0001 },
+    { 0xE0020, 0xE007F }, { 0xE0100, 0xE01EF }
+};
+
+/* sorted list of non-overlapping intervals of East Asian wide (W) and
+ * fullwidth (F) characters */
+static constexpr interval wide[] = {
+    { 0x1100, 0x115F },   /* Hangul Jamo init. consonants */
+    { 0x2E80, 0x3009 }, { 0x300C, 0x3019 }, { 0x301C, 0x303E },
+    { 0x3040, 0xA4CF },   /* CJK ... Yi */
+    { 0xAC00, 0xD7A3 },   /* Hangul Syllables */
+    { 0xF900, 0xFAFF },   /* CJK Compatibility Ideographs */
+    { 0xFE30, 0xFE6F },   /* CJK Compatibility Forms */
+    { 0xFF00, 0xFF5F },   /* Fullwidth Forms */
+    { 0xFFE0, 0xFFE6 },
+    { 0x1F300, 0x1F64F }, /* Pictographs, Emoticons */
+    { 0x1F680, 0x1F6FF }, /* Transport and Map Symbols */
+    { 0x1F900, 0x1F9FF }, /* Supplemental Symbols and Pictographs */
+    { 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD }
+};
+
+/* C0/C1 control characters and DEL */
+static constexpr interval control[] = {
+    { 0x0001, 0x001F }, { 0x007F, 0x009F }
 };
 
 /* auxiliary function for binary search in interval table */
-static int bisearch(quint16 ucs, const struct interval * table, int max)
+static int bisearch(uint ucs, const struct interval * table, int max)
 {
     int min = 0;
     int mid;
@@ -48,6 +110,51 @@ static int bisearch(quint16 ucs, const struct interval * table, int max)
     return 0;
 }
 
+template<int N>
+static constexpr int tableSize(const interval (&)[N])
+{
+    return N;
+}
+
+/* auxiliary function for linear search in interval table at compile time */
+template<int N>
+static constexpr bool inTable(uint ucs, const interval (&table)[N])
+{
+    for (int i = 0; i < N; i++) {
+        if (ucs >= table[i].first && ucs <= table[i].last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* returns true if the table has an interval which covers only a part of the
+ * 256 characters starting at 'start' */
+template<int N>
+static constexpr bool splitsBlock(uint start, const interval (&table)[N])
+{
+    for (int i = 0; i < N; i++) {
+        if (table[i].first <= start + 255 && table[i].last >= start &&
+            (table[i].first > start || table[i].last < start + 255)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* sets the width of the characters of the table which fall into the 256
+ * characters starting at 'start' */
+template<int N>
+static constexpr void applyTable(qint8* widths, uint start,
+                                 const interval (&table)[N], int width)
+{
+    for (int i = 0; i < N; i++) {
+        for (uint ucs = qMax(table[i].first, start);
+             ucs <= qMin(table[i].last, start + 255); ucs++) {
+            widths[ucs - start] = width;
+        }
+    }
+}
 
 /* The following functions define the column width of an ISO 10646
  * character as follows:
@@ -75,76 +182,114 @@ static int bisearch(quint16 ucs, const struct interval * table, int max)
  *      ISO 8859-1 and WGL4 characters, Unicode control characters,
  *      etc.) have a column width of 1.
  *
- * This implementation assumes that quint16 characters are encoded
+ * This implementation assumes that characters are encoded
  * in ISO 10646.
  */
 
-int konsole_wcwidth(quint16 ucs) {
-    /* sorted list of non-overlapping intervals of non-spacing characters */
-    static const struct interval combining[] = {
-    { 0x0300, 0x034E }, { 0x0360, 0x0362 }, { 0x0483, 0x0486 },
-    { 0x0488, 0x0489 }, { 0x0591, 0x05A1 }, { 0x05A3, 0x05B9 },
-    { 0x05BB, 0x05BD }, { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 },
-    { 0x05C4, 0x05C4 }, { 0x064B, 0x0655 }, { 0x0670, 0x0670 },
-    { 0x06D6, 0x06E4 }, { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED },
-    { 0x070F, 0x070F }, { 0x0711, 0x0711 }, { 0x0730, 0x074A },
-    { 0x07A6, 0x07B0 }, { 0x0901, 0x0902 }, { 0x093C, 0x093C },
-    { 0x0941, 0x0948 }, { 0x094D, 0x094D }, { 0x0951, 0x0954 },
-    { 0x0962, 0x0963 }, { 0x0981, 0x0981 }, { 0x09BC, 0x09BC },
-    { 0x09C1, 0x09C4 }, { 0x09CD, 0x09CD }, { 0x09E2, 0x09E3 },
-    { 0x0A02, 0x0A02 }, { 0x0A3C, 0x0A3C }, { 0x0A41, 0x0A42 },
-    { 0x0A47, 0x0A48 }, { 0x0A4B, 0x0A4D }, { 0x0A70, 0x0A71 },
-    { 0x0A81, 0x0A82 }, { 0x0ABC, 0x0ABC }, { 0x0AC1, 0x0AC5 },
-    { 0x0AC7, 0x0AC8 }, { 0x0ACD, 0x0ACD }, { 0x0B01, 0x0B01 },
-    { 0x0B3C, 0x0B3C }, { 0x0B3F, 0x0B3F }, { 0x0B41, 0x0B43 },
-    { 0x0B4D, 0x0B4D }, { 0x0B56, 0x0B56 }, { 0x0B82, 0x0B82 },
-    { 0x0BC0, 0x0BC0 }, { 0x0BCD, 0x0BCD }, { 0x0C3E, 0x0C40 },
-    { 0x0C46, 0x0C48 }, { 0x0C4A, 0x0C4D }, { 0x0C55, 0x0C56 },
-    { 0x0CBF, 0x0CBF }, { 0x0CC6, 0x0CC6 }, { 0x0CCC, 0x0CCD },
-    { 0x0D41, 0x0D43 }, { 0x0D4D, 0x0D4D }, { 0x0DCA, 0x0DCA },
-    { 0x0DD2, 0x0DD4 }, { 0x0DD6, 0x0DD6 }, { 0x0E31, 0x0E31 },
-    { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E }, { 0x0EB1, 0x0EB1 },
-    { 0x0EB4, 0x0EB9 }, { 0x0EBB, 0x0EBC }, { 0x0EC8, 0x0ECD },
-    { 0x0F18, 0x0F19 }, { 0x0F35, 0x0F35 }, { 0x0F37, 0x0F37 },
-    { 0x0F39, 0x0F39 }, { 0x0F71, 0x0F7E }, { 0x0F80, 0x0F84 },
-    { 0x0F86, 0x0F87 }, { 0x0F90, 0x0F97 }, { 0x0F99, 0x0FBC },
-    { 0x0FC6, 0x0FC6 }, { 0x102D, 0x1030 }, { 0x1032, 0x1032 },
-    { 0x1036, 0x1037 }, { 0x1039, 0x1039 }, { 0x1058, 0x1059 },
-    { 0x1160, 0x11FF }, { 0x17B7, 0x17BD }, { 0x17C6, 0x17C6 },
-    { 0x17C9, 0x17D3 }, { 0x180B, 0x180E }, { 0x18A9, 0x18A9 },
-    { 0x200B, 0x200F }, { 0x202A, 0x202E }, { 0x206A, 0x206F },
-    { 0x20D0, 0x20E3 }, { 0x302A, 0x302F }, { 0x3099, 0x309A },
-    { 0xFB1E, 0xFB1E }, { 0xFE20, 0xFE23 }, { 0xFEFF, 0xFEFF },
-    { 0xFFF9, 0xFFFB }
-};
-
-    /* test for 8-bit control characters */
+static constexpr int characterWidth(uint ucs)
+{
     if (ucs == 0) {
         return 0;
     }
-    if (ucs < 32 || (ucs >= 0x7f && ucs < 0xa0)) {
+    if (inTable(ucs, control)) {
         return -1;
     }
-
-    /* binary search in table of non-spacing characters */
-    if (bisearch(ucs, combining,
-                 sizeof(combining) / sizeof(struct interval) - 1)) {
+    if (inTable(ucs, combining)) {
         return 0;
     }
+    return inTable(ucs, wide) ? 2 : 1;
+}
+
+/* returns true if the characters of the given block of the BMP do not all
+ * have the same width */
+static constexpr bool isMixedBlock(uint block)
+{
+    const uint start = block << 8;
+    return start == 0 || splitsBlock(start, control) ||
+           splitsBlock(start, combining) || splitsBlock(start, wide);
+}
+
+static constexpr int mixedBlockCount()
+{
+    int count = 0;
+    for (uint block = 0; block < 256; block++) {
+        if (isMixedBlock(block)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/* The widths of the characters in the BMP, computed at compile time.
+ *
+ * The BMP is split into 256 blocks of 256 characters.  The first level of
+ * the table maps a block to a row of widths in the second level.  Blocks in
+ * which all characters have the same width share one of the four uniform
+ * rows, so only the few blocks with mixed widths need a row of their own. */
+class BmpWidthTable {
+public:
+    constexpr BmpWidthTable()
+        : _rows(), _widths()
+    {
+        for (int width = -1; width <= 2; width++) {
+            for (int i = 0; i < 256; i++) {
+                _widths[width + 1][i] = width;
+            }
+        }
+
+        int row = UniformRows;
+        for (uint block = 0; block < 256; block++) {
+            const uint start = block << 8;
+            if (!isMixedBlock(block)) {
+                _rows[block] = characterWidth(start) + 1;
+                continue;
+            }
+
+            /* apply the rules in reverse order of precedence */
+            qint8* widths = _widths[row];
+            for (int i = 0; i < 256; i++) {
+                widths[i] = 1;
+            }
+            applyTable(widths, start, wide, 2);
+            applyTable(widths, start, combining, 0);
+            applyTable(widths, start, control, -1);
+            if (start == 0) {
+                widths[0] = 0;
+            }
+            _rows[block] = row++;
+        }
+    }
+
+    int width(uint ucs) const
+    {
+        return _widths[_rows[ucs >> 8]][ucs & 0xFF];
+    }
+
+private:
+    enum { UniformRows = 4 };
+
+    quint8 _rows[256];
+    qint8 _widths[UniformRows + mixedBlockCount()][256];
+};
+
+static constexpr BmpWidthTable bmpWidths;
 
-    /* if we arrive here, ucs is not a combining or C0/C1 control character */
-
-    return 1 +
-            (ucs >= 0x1100 &&
-             (ucs <= 0x115f ||                    /* Hangul Jamo init. consonants */
-              (ucs >= 0x2e80 && ucs <= 0xa4cf && (ucs & ~0x0011) != 0x300a &&
-            ucs != 0x303f) ||                  /* CJK ... Yi */
-              (ucs >= 0xac00 && ucs <= 0xd7a3) || /* Hangul Syllables */
-              (ucs >= 0xf900 && ucs <= 0xfaff) || /* CJK Compatibility Ideographs */
-              (ucs >= 0xfe30 && ucs <= 0xfe6f) || /* CJK Compatibility Forms */
-              (ucs >= 0xff00 && ucs <= 0xff5f) || /* Fullwidth Forms */
-              (ucs >= 0xffe0 && ucs <= 0xffe6) /* do not compare UINT16 with 0x20000 ||
-                (ucs >= 0x20000 && ucs <= 0x2ffff) */));
+int konsole_wcwidth(uint ucs) {
+    /* printable ASCII, which makes up most of the output */
+    if (ucs >= 0x20 && ucs < 0x7f) {
+        return 1;
+    }
+
+    /* one lookup in each level of the table for the BMP */
+    if (ucs < 0x10000) {
+        return bmpWidths.width(ucs);
+    }
+
+    /* binary search in the tables for the other planes */
+    if (bisearch(ucs, combining, tableSize(combining) - 1)) {
+        return 0;
+    }
+    return bisearch(ucs, wide, tableSize(wide) - 1) ? 2 : 1;
 }
 
 // single byte char: +1, multi byte char: +2
@@ -152,7 +297,12 @@ int string_width( QString txt )
 {
     int w = 0;
     for ( int i = 0; i < txt.length(); ++i ) {
-        w += konsole_wcwidth( txt[ i ].unicode() );
+        uint ucs = txt[ i ].unicode();
+        if ( QChar::isHighSurrogate( ucs ) && i + 1 < txt.length() &&
+             txt[ i + 1 ].isLowSurrogate() ) {
+            ucs = QChar::surrogateToUcs4( ucs, txt[ ++i ].unicode() );
+        }
+        w += konsole_wcwidth( ucs );
     }
     return w;
 }
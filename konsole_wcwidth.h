@@ -20,5 +20,5 @@
 #include <QtGlobal>
 class QString;
 
-int konsole_wcwidth(quint16 ucs);
+int konsole_wcwidth(uint ucs);
 int string_width( QString txt );
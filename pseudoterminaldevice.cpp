@@ -38,6 +38,7 @@
 
 #include "pseudoterminaldevice.h"
 
+#include <QElapsedTimer>
 #include <QSocketNotifier>
 #include <QDebug>
 
@@ -87,17 +88,70 @@ static void qt_ignore_sigpipe()
 
 #define NO_INTR(ret,func) do { ret = func; } while (ret < 0 && errno == EINTR)
 
+// size of a single read() while draining the master with a read budget
+#define LARGE_READ_SIZE 65536
+
+/*
+   Reads from the master until it has nothing more to offer (EAGAIN) or the
+   read budget is used up, so that a burst of output is taken in with one
+   wakeup instead of one wakeup per FIONREAD sized piece.
+   Returns the number of bytes read, 0 at the end of the input, or -1 if
+   there was nothing to read.
+*/
+qint64 PseudoTerminalDevicePrivate::drainMaster()
+{
+    Q_Q(PseudoTerminalDevice);
+    qint64 totalBytes = 0;
+    QElapsedTimer clock;
+    clock.start();
+
+    while (totalBytes < readBudgetBytes) {
+        int chunk = (int)qMin<qint64>(LARGE_READ_SIZE, readBudgetBytes - totalBytes);
+        char *ptr = readBuffer.reserve(chunk);
+        qint64 readBytes;
+        NO_INTR(readBytes, read(q->masterFd(), ptr, chunk));
+        readStatistics.reads++;
+
+        if (readBytes < 0) {
+            readBuffer.unreserve(chunk);
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return totalBytes ? totalBytes : -1;
+            // on Linux the master reports EIO once the slave is closed,
+            // deliver what we have and take it as the end next time
+            if (!totalBytes)
+                return 0;
+            break;
+        }
+
+        readBuffer.unreserve(chunk - readBytes);
+        if (!readBytes)
+            return totalBytes;
+        totalBytes += readBytes;
+        readStatistics.bytes += readBytes;
+
+        if (readBudgetMsecs > 0 && clock.elapsed() >= readBudgetMsecs)
+            break;
+    }
+    return totalBytes;
+}
+
 bool PseudoTerminalDevicePrivate::_k_canRead()
 {
     Q_Q(PseudoTerminalDevice);
     qint64 readBytes = 0;
 
+    readStatistics.wakeups++;
+
 #ifdef Q_OS_IRIX // this should use a config define, but how to check it?
     size_t available;
 #else
     int available;
 #endif
-    if (!::ioctl(q->masterFd(), PTY_BYTES_AVAILABLE, (char *) &available)) {
+    if (readBudgetBytes > 0) {
+        readBytes = drainMaster();
+        if (readBytes < 0)
+            return true;
+    } else if (!::ioctl(q->masterFd(), PTY_BYTES_AVAILABLE, (char *) &available)) {
 #ifdef Q_OS_SOLARIS
         // A Pty is a STREAMS module, and those can be activated
         // with 0 bytes available. This happens either when ^C is
@@ -141,6 +195,8 @@ bool PseudoTerminalDevicePrivate::_k_canRead()
             return false;
         }
         readBuffer.unreserve(available - readBytes); // *should* be a no-op
+        readStatistics.reads++;
+        readStatistics.bytes += readBytes;
     }
 
     if (!readBytes) {
@@ -282,6 +338,7 @@ void PseudoTerminalDevicePrivate::finishOpen(QIODevice::OpenMode mode)
     q->QIODevice::open(mode);
     fcntl(q->masterFd(), F_SETFL, O_NONBLOCK);
     readBuffer.clear();
+    q->resetReadStatistics();
     readNotifier = new QSocketNotifier(q->masterFd(), QSocketNotifier::Read, q);
     writeNotifier = new QSocketNotifier(q->masterFd(), QSocketNotifier::Write, q);
     QObject::connect(readNotifier, SIGNAL(activated(int)), q, SLOT(_k_canRead()));
@@ -896,6 +953,59 @@ bool PseudoTerminalDevice::waitForBytesWritten(int msecs)
     return d->doWait(msecs, false);
 }
 
+const char *PseudoTerminalDevice::readBufferPointer() const
+{
+    Q_D(const PseudoTerminalDevice);
+    return d->readBuffer.readPointer();
+}
+
+int PseudoTerminalDevice::readBufferSize() const
+{
+    Q_D(const PseudoTerminalDevice);
+    return d->readBuffer.isEmpty() ? 0 : d->readBuffer.readSize();
+}
+
+void PseudoTerminalDevice::freeReadBuffer(int bytes)
+{
+    Q_D(PseudoTerminalDevice);
+    Q_ASSERT(bytes <= readBufferSize());
+    d->readBuffer.free(bytes);
+}
+
+void PseudoTerminalDevice::setReadBudget(int bytes, int msecs)
+{
+    Q_D(PseudoTerminalDevice);
+    d->readBudgetBytes = qMax(0, bytes);
+    d->readBudgetMsecs = qMax(0, msecs);
+}
+
+int PseudoTerminalDevice::readBudgetBytes() const
+{
+    Q_D(const PseudoTerminalDevice);
+    return d->readBudgetBytes;
+}
+
+int PseudoTerminalDevice::readBudgetMsecs() const
+{
+    Q_D(const PseudoTerminalDevice);
+    return d->readBudgetMsecs;
+}
+
+PseudoTerminalReadStatistics PseudoTerminalDevice::readStatistics() const
+{
+    Q_D(const PseudoTerminalDevice);
+    PseudoTerminalReadStatistics statistics = d->readStatistics;
+    statistics.elapsed = d->readStatisticsClock.elapsed();
+    return statistics;
+}
+
+void PseudoTerminalDevice::resetReadStatistics()
+{
+    Q_D(PseudoTerminalDevice);
+    d->readStatistics = PseudoTerminalReadStatistics();
+    d->readStatisticsClock.start();
+}
+
 void PseudoTerminalDevice::setSuspended(bool suspended)
 {
     Q_D(PseudoTerminalDevice);
@@ -37,6 +37,7 @@
 
 #include "ringbuffer.h"
 
+#include <QElapsedTimer>
 #include <QIODevice>
 
 struct PseudoTerminalDevicePrivate;
@@ -163,6 +164,17 @@ extern "C" {
 struct termios;
 class QSocketNotifier;
 
+/**
+ * Counters describing how the incoming data of a PseudoTerminalDevice has
+ * been read.  See PseudoTerminalDevice::readStatistics()
+ */
+struct PseudoTerminalReadStatistics {
+    quint64 wakeups; // number of times the pty became readable
+    quint64 reads;   // number of read() calls
+    quint64 bytes;   // number of bytes read
+    qint64 elapsed;  // milliseconds during which the counters were taken
+};
+
 /**
  * Encapsulates KPty into a QIODevice, so it can be used with Q*Stream, etc.
  */
@@ -387,6 +399,56 @@ public:
     bool waitForBytesWritten(int msecs = -1);
     bool waitForReadyRead(int msecs = -1);
 
+    /**
+     * @return a pointer to the first contiguous block of buffered incoming
+     *  data. Only valid if readBufferSize() is non-zero.
+     *
+     * Together with readBufferSize() and freeReadBuffer() this allows the
+     * incoming data to be consumed in place, without copying it out of the
+     * device via read() or readAll() first. The pointer stays valid until
+     * freeReadBuffer() is called or control returns to the event loop.
+     */
+    const char *readBufferPointer() const;
+
+    /**
+     * @return the size of the block returned by readBufferPointer(), or 0
+     *  if no incoming data is buffered.
+     */
+    int readBufferSize() const;
+
+    /**
+     * Discards the first @p bytes bytes of the buffered incoming data.
+     * @p bytes must not exceed readBufferSize().
+     */
+    void freeReadBuffer(int bytes);
+
+    /**
+     * Sets a budget for reading incoming data.
+     *
+     * By default only the number of bytes reported by FIONREAD is read each
+     * time the pty becomes readable.  With a budget of @p bytes greater than
+     * 0, the pty master is drained with large non-blocking reads until no
+     * more data is available, @p bytes have been read or @p msecs
+     * milliseconds have passed (if @p msecs is greater than 0).  readyRead()
+     * is emitted once for everything read in one go.
+     */
+    void setReadBudget(int bytes, int msecs = 0);
+
+    /** Returns the read budget in bytes, 0 if none is set.  See setReadBudget() */
+    int readBudgetBytes() const;
+
+    /** Returns the read budget in milliseconds.  See setReadBudget() */
+    int readBudgetMsecs() const;
+
+    /**
+     * Returns counters describing how the incoming data has been read since
+     * the pty was opened or resetReadStatistics() was called.
+     */
+    PseudoTerminalReadStatistics readStatistics() const;
+
+    /** Resets the counters returned by readStatistics(). */
+    void resetReadStatistics();
+
 signals:
     /**
      * Emitted when EOF is read from the PTY.
@@ -421,10 +483,14 @@ struct PseudoTerminalDevicePrivate {
         emittedReadyRead(false),
         emittedBytesWritten(false),
         readNotifier(0),
-        writeNotifier(0) {
+        writeNotifier(0),
+        readBudgetBytes(0),
+        readBudgetMsecs(0),
+        readStatistics() {
     }
 
     bool _k_canRead();
+    qint64 drainMaster();
     bool _k_canWrite();
 
     bool doWait(int msecs, bool reading);
@@ -444,4 +510,9 @@ struct PseudoTerminalDevicePrivate {
     QSocketNotifier *writeNotifier;
     RingBuffer readBuffer;
     RingBuffer writeBuffer;
+
+    int readBudgetBytes;
+    int readBudgetMsecs;
+    PseudoTerminalReadStatistics readStatistics;
+    QElapsedTimer readStatisticsClock;
 };
@@ -55,6 +55,10 @@
 
 #define DUMMYENV "_KPROCESS_DUMMY_="
 
+// while reads are coalesced, output is delivered as soon as this much has
+// piled up in the read buffer
+#define READ_COALESCING_SIZE 16384
+
 PseudoTerminalProcess::PseudoTerminalProcess(QObject *parent) :
     QProcess(parent) {
     _pseudoTerminalDevice = new PseudoTerminalDevice(this);
@@ -276,6 +280,11 @@ void PseudoTerminalProcess::initialize() {
     _utf8 = true;
     _addUtmp = false;
 
+    _readCoalescingInterval = 0;
+    _readCoalescingTimer = new QTimer(this);
+    _readCoalescingTimer->setSingleShot(true);
+    connect(_readCoalescingTimer, SIGNAL(timeout()), this, SLOT(flushReceivedData()));
+
     connect(pseudoTerminalDevice(), SIGNAL(readyRead()) , this , SLOT(dataReceived()));
     setPseudoTerminalChannels(PseudoTerminalProcess::AllChannels);
 }
@@ -292,9 +301,56 @@ void PseudoTerminalProcess::sendData(const char* data, int length)
     }
 }
 
+void PseudoTerminalProcess::setReadBudget(int bytes, int msecs)
+{
+    pseudoTerminalDevice()->setReadBudget(bytes, msecs);
+}
+
+PseudoTerminalReadStatistics PseudoTerminalProcess::readStatistics() const
+{
+    return pseudoTerminalDevice()->readStatistics();
+}
+
+void PseudoTerminalProcess::setReadCoalescing(int msecs)
+{
+    _readCoalescingInterval = msecs;
+    if (!msecs && _readCoalescingTimer->isActive())
+        flushReceivedData();
+}
+
+void PseudoTerminalProcess::setReadSuspended(bool suspended)
+{
+    // the read notifier is also switched off at the end of the input,
+    // don't wake it up again once the program has gone
+    if (!suspended && state() == QProcess::NotRunning)
+        return;
+
+    pseudoTerminalDevice()->setSuspended(suspended);
+}
+
 void PseudoTerminalProcess::dataReceived() {
-    QByteArray data = pseudoTerminalDevice()->readAll();
-    emit receivedData(data.constData(),data.count());
+    // Let small reads pile up in the device's read buffer for a moment, so
+    // that the emulation parses them in one pass rather than one by one.
+    if (_readCoalescingInterval > 0 &&
+        pseudoTerminalDevice()->bytesAvailable() < READ_COALESCING_SIZE) {
+        if (!_readCoalescingTimer->isActive())
+            _readCoalescingTimer->start(_readCoalescingInterval);
+        return;
+    }
+
+    flushReceivedData();
+}
+
+void PseudoTerminalProcess::flushReceivedData() {
+    _readCoalescingTimer->stop();
+
+    // Hand out the incoming data block by block, straight from the device's
+    // read buffer, rather than copying it into a temporary QByteArray first.
+    PseudoTerminalDevice *device = pseudoTerminalDevice();
+    while (int length = device->readBufferSize()) {
+        emit receivedData(device->readBufferPointer(), length);
+        device->freeReadBuffer(length);
+    }
 }
 
 int PseudoTerminalProcess::foregroundProcessGroup() const {
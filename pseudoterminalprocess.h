@@ -38,6 +38,7 @@
 
 // Own includes
 class PseudoTerminalDevice;
+struct PseudoTerminalReadStatistics;
 
 // System includes
 #include <signal.h>
@@ -48,6 +49,7 @@ class PseudoTerminalDevice;
 #include <QList>
 #include <QSize>
 #include <QProcess>
+#include <QTimer>
 
 /**
  * TODO: doc
@@ -358,6 +360,18 @@ public:
      */
     static int startDetached(QStringList argv);
 
+    /**
+     * Sets the budget for reading the output of the process in one go.
+     * See PseudoTerminalDevice::setReadBudget()
+     */
+    void setReadBudget(int bytes, int msecs = 0);
+
+    /**
+     * Returns counters describing how the output of the process has been
+     * read.  See PseudoTerminalDevice::readStatistics()
+     */
+    PseudoTerminalReadStatistics readStatistics() const;
+
 public slots:
     /**
      * Put the pty into UTF-8 mode on systems which support it.
@@ -374,12 +388,29 @@ public slots:
      */
     void sendData(const char* buffer, int length);
 
+    /**
+     * Sets how long small amounts of output may be held back, so that
+     * output which arrives in many small reads is delivered in one go.
+     * Output is delivered as soon as it arrives if @p msecs is 0, which is
+     * the default.
+     */
+    void setReadCoalescing(int msecs);
+
+    /**
+     * Stops or resumes reading from the teletype.  While reading is
+     * suspended the teletype's buffer fills up and the terminal program
+     * is blocked when it tries to write more output.
+     */
+    void setReadSuspended(bool suspended);
+
 signals:
     /**
      * Emitted when a new block of data is received from
      * the teletype.
      *
-     * @param buffer Pointer to the data received.
+     * @param buffer Pointer to the data received. It points directly into
+     * the pty's read buffer and is only valid while the signal is being
+     * emitted, so receivers must be connected with a direct connection.
      * @param length Length of @p buffer
      */
     void receivedData(const char* buffer, int length);
@@ -389,6 +420,7 @@ protected:
 
 private slots:
     void dataReceived();
+    void flushReceivedData();
     void stateChanged(QProcess::ProcessState newState);
 
 private:
@@ -404,6 +436,9 @@ private:
     bool _xonXoff;
     bool _utf8;
 
+    int _readCoalescingInterval;
+    QTimer *_readCoalescingTimer;
+
     PseudoTerminalDevice *_pseudoTerminalDevice;
     PseudoTerminalProcess::PseudoTerminalChannels _pseudoTerminalChannels;
     bool _addUtmp;
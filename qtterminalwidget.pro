@@ -2,7 +2,7 @@ QT += widgets
 
 TEMPLATE = lib
 TARGET = qtterminalwidget
-CONFIG += staticlib
+CONFIG += staticlib c++14
 
 HEADERS += \
            konsole_wcwidth.h \
@@ -28,12 +28,17 @@ HEADERS += \
     ringbuffer.h \
     pseudoterminaldevice.h \
     pseudoterminalprocess.h \
-    terminalemulation.h
+    terminalemulation.h \
+    utf8decoder.h \
+    emulationworker.h \
+    triggersequencescanner.h \
+    screenselection.h
 FORMS += SearchBar.ui
 SOURCES += \
            konsole_wcwidth.cpp \
     terminalwidget.cpp \
     blockarray.cpp \
+    charactercolor.cpp \
     colorscheme.cpp \
     filter.cpp \
     history.cpp \
@@ -49,7 +54,11 @@ SOURCES += \
     terminalsession.cpp \
     pseudoterminaldevice.cpp \
     pseudoterminalprocess.cpp \
-    terminalemulation.cpp
+    terminalemulation.cpp \
+    utf8decoder.cpp \
+    emulationworker.cpp \
+    triggersequencescanner.cpp \
+    screenselection.cpp
 RESOURCES += \
              designer/qtermwidgetplugin.qrc \
     color-schemes/colorschemes.qrc \
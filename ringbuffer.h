@@ -28,11 +28,22 @@
 #pragma once
 
 #include <QByteArray>
-#include <QLinkedList>
 
 #define KMAXINT ((int)(~0U >> 1))
 #define CHUNKSIZE 4096
+// an empty buffer which has grown beyond this size is shrunk back to CHUNKSIZE
+#define MAXRETAINEDSIZE (1024 * 1024)
 
+/**
+ * A FIFO byte buffer for the pty's input and output.
+ *
+ * The data lives in one contiguous block of memory whose size is a power of
+ * two, so readPointer() always covers all of the buffered data and the block
+ * returned by reserve() is always in one piece.  The block is allocated once
+ * and reused: freeing data only moves the read position, and the contents
+ * are moved back to the front of the block instead of allocating more
+ * memory whenever that makes enough room for a reservation.
+ */
 class RingBuffer {
 public:
     RingBuffer() {
@@ -40,88 +51,77 @@ public:
     }
 
     void clear() {
-        buffers.clear();
-        QByteArray tmp;
-        tmp.resize(CHUNKSIZE);
-        buffers << tmp;
+        if (buffer.size() != CHUNKSIZE) {
+            buffer = QByteArray();
+            buffer.resize(CHUNKSIZE);
+        }
         head = tail = 0;
-        totalSize = 0;
     }
 
     inline bool isEmpty() const
     {
-        return buffers.count() == 1 && !tail;
+        return head == tail;
     }
 
     inline int size() const
     {
-        return totalSize;
+        return tail - head;
     }
 
     inline int readSize() const
     {
-        return (buffers.count() == 1 ? tail : buffers.first().size()) - head;
+        return tail - head;
     }
 
     inline const char *readPointer() const
     {
-        Q_ASSERT(totalSize > 0);
-        return buffers.first().constData() + head;
+        Q_ASSERT(size() > 0);
+        return buffer.constData() + head;
     }
 
     void free(int bytes)
     {
-        totalSize -= bytes;
-        Q_ASSERT(totalSize >= 0);
-
-        forever {
-            int nbs = readSize();
-
-            if (bytes < nbs) {
-                head += bytes;
-                if (head == tail && buffers.count() == 1) {
-                    buffers.first().resize(CHUNKSIZE);
-                    head = tail = 0;
-                }
-                break;
-            }
-
-            bytes -= nbs;
-            if (buffers.count() == 1) {
-                buffers.first().resize(CHUNKSIZE);
-                head = tail = 0;
-                break;
-            }
+        Q_ASSERT(bytes <= size());
 
-            buffers.removeFirst();
-            head = 0;
+        head += bytes;
+        if (head == tail) {
+            head = tail = 0;
+            if (buffer.size() > MAXRETAINEDSIZE)
+                clear();
         }
     }
 
     char *reserve(int bytes)
     {
-        totalSize += bytes;
-
-        char *ptr;
-        if (tail + bytes <= buffers.last().size()) {
-            ptr = buffers.last().data() + tail;
-            tail += bytes;
-        } else {
-            buffers.last().resize(tail);
-            QByteArray tmp;
-            tmp.resize(qMax(CHUNKSIZE, bytes));
-            ptr = tmp.data();
-            buffers << tmp;
-            tail = bytes;
+        if (tail + bytes > buffer.size()) {
+            int used = tail - head;
+
+            // move the data to the front of the block, and grow the block
+            // if that does not make enough room
+            if (head) {
+                memmove(buffer.data(), buffer.constData() + head, used);
+                head = 0;
+                tail = used;
+            }
+
+            if (used + bytes > buffer.size()) {
+                int capacity = buffer.size();
+                while (capacity < used + bytes)
+                    capacity *= 2;
+                buffer.resize(capacity);
+            }
         }
+
+        char *ptr = buffer.data() + tail;
+        tail += bytes;
         return ptr;
     }
 
     // release a trailing part of the last reservation
     inline void unreserve(int bytes)
     {
-        totalSize -= bytes;
         tail -= bytes;
+        Q_ASSERT(tail >= head);
     }
 
     inline void write(const char *data, int len)
@@ -134,25 +134,11 @@ public:
     // it is smaller than the buffer size. Otherwise -1 is returned.
     int indexAfter(char c, int maxLength = KMAXINT) const
     {
-        int index = 0;
-        int start = head;
-        QLinkedList<QByteArray>::ConstIterator it = buffers.begin();
-        forever {
-            if (!maxLength)
-                return index;
-            if (index == size())
-                return -1;
-            const QByteArray &buf = *it;
-            ++it;
-            int len = qMin((it == buffers.end() ? tail : buf.size()) - start,
-                           maxLength);
-            const char *ptr = buf.data() + start;
-            if (const char *rptr = (const char *)memchr(ptr, c, len))
-                return index + (rptr - ptr) + 1;
-            index += len;
-            maxLength -= len;
-            start = 0;
-        }
+        int len = qMin(size(), maxLength);
+        const char *ptr = buffer.constData() + head;
+        if (const char *rptr = (const char *)memchr(ptr, c, len))
+            return (rptr - ptr) + 1;
+        return len == maxLength ? len : -1;
     }
 
     inline int lineSize(int maxLength = KMAXINT) const
@@ -168,15 +154,11 @@ public:
     int read(char *data, int maxLength)
     {
         int bytesToRead = qMin(size(), maxLength);
-        int readSoFar = 0;
-        while (readSoFar < bytesToRead) {
-            const char *ptr = readPointer();
-            int bs = qMin(bytesToRead - readSoFar, readSize());
-            memcpy(data + readSoFar, ptr, bs);
-            readSoFar += bs;
-            free(bs);
-        }
-        return readSoFar;
+        if (bytesToRead <= 0)
+            return 0;
+        memcpy(data, readPointer(), bytesToRead);
+        free(bytesToRead);
+        return bytesToRead;
     }
 
     int readLine(char *data, int maxLength)
@@ -185,7 +167,6 @@ public:
     }
 
 private:
-    QLinkedList<QByteArray> buffers;
+    QByteArray buffer;
     int head, tail;
-    int totalSize;
 };
@@ -72,21 +72,36 @@ Character Screen::defaultChar = Character(' ',
 Screen::Screen(int l, int c)
     : lines(l),
       columns(c),
-      screenLines(new ImageLine[lines+1] ),
+      screenLines(new Character[lines*columns]),
+      _lineStride(columns),
+      _lineCapacity(lines),
+      _lineBase(0),
       _scrolledLines(0),
       _droppedLines(0),
-      history(new HistoryScrollNone()),
+      _generation(1),
+      _imageGeneration(1),
+      _reflowLines(false),
+      history(new HistoryScrollReflow(new HistoryScrollNone())),
+      _rgbReclaimDeferred(0),
+      _rgbReclaimFirstLine(0),
       cuX(0), cuY(0),
       currentRendition(0),
       _topMargin(0), _bottomMargin(0),
-      selBegin(0), selTopLeft(0), selBottomRight(0),
-      blockSelectionMode(false),
+      _screenTopLine(0),
       effectiveForeground(CharacterColor()), effectiveBackground(CharacterColor()), effectiveRendition(0),
       lastPos(-1)
 {
-    lineProperties.resize(lines+1);
-    for (int i=0;i<lines+1;i++)
+    lineProperties.resize(lines);
+    _lineLengths.resize(lines);
+    _lineSlots.resize(lines);
+    _lineGenerations.resize(lines);
+    for (int i=0;i<lines;i++)
+    {
         lineProperties[i]=LINE_DEFAULT;
+        _lineLengths[i]=0;
+        _lineSlots[i]=i;
+        _lineGenerations[i]=_generation;
+    }
 
     initTabStops();
     clearSelection();
@@ -201,30 +216,60 @@ void Screen::deleteChars(int n)
     if (n == 0)
         n = 1;
 
+    const int length = lineLength(cuY);
+
     // if cursor is beyond the end of the line there is nothing to do
-    if ( cuX >= screenLines[cuY].count() )
+    if ( cuX >= length )
         return;
 
-    if ( cuX+n > screenLines[cuY].count() )
-        n = screenLines[cuY].count() - cuX;
+    if ( cuX+n > length )
+        n = length - cuX;
 
     Q_ASSERT( n >= 0 );
-    Q_ASSERT( cuX+n <= screenLines[cuY].count() );
+    Q_ASSERT( cuX+n <= length );
 
-    screenLines[cuY].remove(cuX,n);
+    markLinesChanged(cuY,cuY);
+
+    Character* data = lineData(cuY);
+    memmove(data+cuX, data+cuX+n, (length-cuX-n)*sizeof(Character));
+    _lineLengths[lineSlot(cuY)] = length-n;
 }
 
 void Screen::insertChars(int n)
 {
     if (n == 0) n = 1; // Default
 
-    if ( screenLines[cuY].size() < cuX )
-        screenLines[cuY].resize(cuX);
+    markLinesChanged(cuY,cuY);
+
+    if ( lineLength(cuY) < cuX )
+        resizeLine(cuY,cuX);
+
+    // the characters pushed beyond the last column are dropped
+    const int length = lineLength(cuY);
+    const int newLength = qMin(length+n,columns);
+    const int inserted = qMin(n,newLength-cuX);
+    if (inserted <= 0)
+    {
+        _lineLengths[lineSlot(cuY)] = newLength;
+        return;
+    }
+
+    Character* data = lineData(cuY);
+    memmove(data+cuX+inserted, data+cuX, (newLength-cuX-inserted)*sizeof(Character));
+    for (int i=cuX;i<cuX+inserted;i++)
+        data[i] = Character(' ');
+    _lineLengths[lineSlot(cuY)] = newLength;
+}
 
-    screenLines[cuY].insert(cuX,n,' ');
+void Screen::resizeLine(int y, int length)
+{
+    Q_ASSERT( length >= 0 && length <= _lineStride );
 
-    if ( screenLines[cuY].count() > columns )
-        screenLines[cuY].resize(columns);
+    const int slot = lineSlot(y);
+    Character* data = screenLines + slot*_lineStride;
+    for (int i=_lineLengths[slot];i<length;i++)
+        data[i] = Character();
+    _lineLengths[slot] = length;
 }
 
 void Screen::deleteLines(int n)
@@ -241,6 +286,8 @@ void Screen::insertLines(int n)
 
 void Screen::setMode(int m)
 {
+    if (m == MODE_Screen && !currentModes[m])
+        markImageChanged();
     currentModes[m] = true;
     switch(m)
     {
@@ -250,6 +297,8 @@ void Screen::setMode(int m)
 
 void Screen::resetMode(int m)
 {
+    if (m == MODE_Screen && currentModes[m])
+        markImageChanged();
     currentModes[m] = false;
     switch(m)
     {
@@ -295,32 +344,85 @@ void Screen::resizeImage(int new_lines, int new_columns)
 {
     if ((new_lines==lines) && (new_columns==columns)) return;
 
-    if (cuY > new_lines-1)
-    { // attempt to preserve focus and lines
-        _bottomMargin = lines-1; //FIXME: margin lost
-        for (int i = 0; i < cuY-(new_lines-1); i++)
+    if (_reflowLines && new_columns != columns && new_columns > 0)
+    {
+        reflowImage(new_lines,new_columns);
+    }
+    else
+    {
+        if (cuY > new_lines-1)
+        { // attempt to preserve focus and lines
+            _bottomMargin = lines-1; //FIXME: margin lost
+            scrollUpIntoHistory(cuY-(new_lines-1));
+        }
+
+        const int keptLines = qMin(lines,new_lines);
+        const int newStride = qMax(_lineStride,new_columns);
+        QVarLengthArray<int,64> newSlots(new_lines);
+
+        if (newStride == _lineStride && new_lines <= _lineCapacity)
         {
-            addHistLine(); scrollUp(0,1);
+            // the arena is large enough, keep the lines in their slots and
+            // hand out the unused slots to the new lines
+            QVarLengthArray<bool,64> slotUsed(_lineCapacity);
+            for (int i=0;i<_lineCapacity;i++)
+                slotUsed[i] = false;
+            for (int i=0;i<keptLines;i++)
+            {
+                newSlots[i] = lineSlot(i);
+                slotUsed[newSlots[i]] = true;
+            }
+            int slot = 0;
+            for (int i=keptLines;i<new_lines;i++)
+            {
+                while (slotUsed[slot])
+                    slot++;
+                newSlots[i] = slot++;
+            }
+        }
+        else
+        {
+            // create a larger arena and copy the lines from old to new
+            Character* newScreenLines = new Character[new_lines*newStride];
+            QVarLengthArray<int,64> newLengths(new_lines);
+            QVarLengthArray<LineProperty,64> newLineProperties(new_lines);
+            for (int i=0;i<keptLines;i++)
+            {
+                memcpy(newScreenLines + i*newStride, lineData(i), lineLength(i)*sizeof(Character));
+                newLengths[i] = lineLength(i);
+                newLineProperties[i] = lineProperties[lineSlot(i)];
+            }
+            for (int i=0;i<new_lines;i++)
+                newSlots[i] = i;
+
+            delete[] screenLines;
+            screenLines = newScreenLines;
+            _lineStride = newStride;
+            _lineCapacity = new_lines;
+            _lineLengths = newLengths;
+            lineProperties = newLineProperties;
         }
-    }
 
-    // create new screen lines and copy from old to new
+        _lineSlots = newSlots;
+        _lineBase = 0;
 
-    ImageLine* newScreenLines = new ImageLine[new_lines+1];
-    for (int i=0; i < qMin(lines,new_lines+1) ;i++)
-        newScreenLines[i]=screenLines[i];
-    for (int i=lines;(i > 0) && (i<new_lines+1);i++)
-        newScreenLines[i].resize( new_columns );
+        // new lines start out blank
+        for (int i=keptLines;i<new_lines;i++)
+        {
+            const int slot = newSlots[i];
+            Character* data = screenLines + slot*_lineStride;
+            for (int j=0;j<new_columns;j++)
+                data[j] = Character();
+            _lineLengths[slot] = new_columns;
+            lineProperties[slot] = LINE_DEFAULT;
+        }
+    }
 
-    lineProperties.resize(new_lines+1);
-    for (int i=lines;(i > 0) && (i<new_lines+1);i++)
-        lineProperties[i] = LINE_DEFAULT;
+    _lineGenerations.resize(new_lines);
+    markImageChanged();
 
     clearSelection();
 
-    delete[] screenLines;
-    screenLines = newScreenLines;
-
     lines = new_lines;
     columns = new_columns;
     cuX = qMin(cuX,columns-1);
@@ -333,6 +435,175 @@ void Screen::resizeImage(int new_lines, int new_columns)
     clearSelection();
 }
 
+void Screen::setReflowLines(bool enable)
+{
+    _reflowLines = enable;
+}
+
+bool Screen::reflowLines() const
+{
+    return _reflowLines;
+}
+
+void Screen::reflowImage(int new_lines, int new_columns)
+{
+    clearSelection();
+
+    // the history is wrapped at the new width when it is read next, the
+    // rows which are moved into it below already have that width
+    history->setColumns(new_columns);
+
+    // the lines to reflow end at the cursor or at the last line with text
+    // below it, whichever comes last
+    int lastLine = cuY;
+    for (int y = lines-1; y > lastLine; y--)
+    {
+        if (textLength(y) > 0)
+        {
+            lastLine = y;
+            break;
+        }
+    }
+
+    // join the lines wrapped at the old width into logical lines and split
+    // them again at the new width
+    QVector<Character> text;
+    QVector<Character> rows;             // new_columns characters per row
+    QVector<int> rowLengths;
+    QVector<LineProperty> rowProperties;
+    int cursorRow = 0;
+    int cursorColumn = 0;
+
+    int y = 0;
+    while (y <= lastLine)
+    {
+        const LineProperty properties = lineProperties[lineSlot(y)] & ~LINE_WRAPPED;
+        int cursorOffset = -1;
+
+        text.resize(0);
+        bool wrapped;
+        do
+        {
+            wrapped = lineProperties[lineSlot(y)] & LINE_WRAPPED;
+            const int length = wrapped ? qMin(lineLength(y),columns) : textLength(y);
+            const int offset = text.size();
+
+            if (y == cuY)
+                cursorOffset = offset + cuX;
+
+            text.resize(offset + length);
+            memcpy(text.data() + offset, lineData(y), length*sizeof(Character));
+            y++;
+        }
+        while (wrapped && y <= lastLine);
+
+        // keep the cursor where it was relative to the text, even if it is
+        // beyond the end of it
+        if (text.size() < cursorOffset)
+            text.resize(cursorOffset);
+
+        int start = 0;
+        do
+        {
+            int length = qMin(new_columns, text.size()-start);
+
+            // do not separate a double width character from its right half
+            if (start+length < text.size() && length > 1 && text[start+length].character == 0)
+                length--;
+
+            const bool last = (start+length >= text.size());
+            const int row = rowLengths.size();
+            rows.resize((row+1)*new_columns);
+            memcpy(rows.data() + row*new_columns, text.constData() + start, length*sizeof(Character));
+            rowLengths.append(length);
+            rowProperties.append(properties | (last ? 0 : LINE_WRAPPED));
+
+            if (cursorOffset >= start && (cursorOffset < start+length || last))
+            {
+                cursorRow = row;
+                cursorColumn = cursorOffset-start;
+            }
+
+            start += length;
+        }
+        while (start < text.size());
+    }
+
+    // move the rows which no longer fit on the screen into the history.
+    // Normally these are above the cursor, but if there is more text below
+    // the cursor than fits on the screen the cursor's row goes as well
+    // rather than losing the rows at the bottom
+    const int rowCount = rowLengths.size();
+    const int overflow = qMax(0,rowCount-new_lines);
+    for (int row = 0; row < overflow; row++)
+    {
+        if (!hasScroll())
+            continue;
+
+        const int oldHistLines = history->getLines();
+        history->addCells(rows.constData() + row*new_columns,rowLengths[row]);
+        history->addLine(rowProperties[row] & LINE_WRAPPED);
+        addHistoryColors(rows.constData() + row*new_columns,rowLengths[row]);
+        _droppedLines += oldHistLines + 1 - history->getLines();
+        _screenTopLine++;
+    }
+
+    // lay out the remaining rows in the arena, reusing it if it is large enough
+    const int newStride = qMax(_lineStride,new_columns);
+    if (newStride != _lineStride || new_lines > _lineCapacity)
+    {
+        delete[] screenLines;
+        screenLines = new Character[new_lines*newStride];
+        _lineStride = newStride;
+        _lineCapacity = new_lines;
+        _lineLengths.resize(new_lines);
+        lineProperties.resize(new_lines);
+    }
+
+    _lineSlots.resize(new_lines);
+    _lineBase = 0;
+    for (int line = 0; line < new_lines; line++)
+    {
+        const int row = overflow+line;
+        _lineSlots[line] = line;
+        if (row < rowCount)
+        {
+            memcpy(screenLines + line*_lineStride, rows.constData() + row*new_columns,
+                   rowLengths[row]*sizeof(Character));
+            _lineLengths[line] = rowLengths[row];
+            lineProperties[line] = rowProperties[row];
+        }
+        else
+        {
+            _lineLengths[line] = 0;
+            lineProperties[line] = LINE_DEFAULT;
+        }
+    }
+
+    if (cursorRow >= overflow)
+    {
+        cuY = cursorRow-overflow;
+        cuX = cursorColumn;
+    }
+    else
+    {
+        // the cursor's row is in the history now, continue on the row
+        // which followed it
+        cuY = 0;
+        cuX = 0;
+    }
+    lastPos = -1;
+}
+
+int Screen::textLength(int y) const
+{
+    const Character* data = lineData(y);
+    int length = lineLength(y);
+    while (length > 0 && data[length-1] == defaultChar)
+        length--;
+    return length;
+}
+
 void Screen::setDefaultMargins()
 {
     _topMargin = 0;
@@ -383,6 +654,16 @@ void Screen::reverseRendition(Character& p) const
     p.backgroundColor = f; //p->r &= ~RE_TRANSPARENT;
 }
 
+void Screen::reverseRendition(Character* p, int count) const
+{
+    for (int i = 0; i < count; i++)
+    {
+        CharacterColor f = p[i].foregroundColor;
+        p[i].foregroundColor = p[i].backgroundColor;
+        p[i].backgroundColor = f;
+    }
+}
+
 void Screen::updateEffectiveRendition()
 {
     effectiveRendition = currentRendition;
@@ -416,16 +697,9 @@ void Screen::copyFromHistory(Character* dest, int startLine, int count) const
             dest[destLineOffset+column] = defaultChar;
 
         // invert selected text
-        if (selBegin !=-1)
-        {
-            for (int column = 0; column < columns; column++)
-            {
-                if (isSelected(column,line))
-                {
-                    reverseRendition(dest[destLineOffset + column]);
-                }
-            }
-        }
+        int first, last;
+        if (selectedColumns(line,first,last))
+            reverseRendition(dest + destLineOffset + first, last-first+1);
     }
 }
 
@@ -435,21 +709,18 @@ void Screen::copyFromScreen(Character* dest , int startLine , int count) const
 
     for (int line = startLine; line < (startLine+count) ; line++)
     {
-        int srcLineStartIndex  = line*columns;
-        int destLineStartIndex = (line-startLine)*columns;
+        Character* destLine = dest + (line-startLine)*columns;
 
-        for (int column = 0; column < columns; column++)
-        {
-            int srcIndex = srcLineStartIndex + column;
-            int destIndex = destLineStartIndex + column;
-
-            dest[destIndex] = screenLines[srcIndex/columns].value(srcIndex%columns,defaultChar);
-
-            // invert selected text
-            if (selBegin != -1 && isSelected(column,line + history->getLines()))
-                reverseRendition(dest[destIndex]);
-        }
+        // the used part of the line is copied as a whole, the rest is blank
+        const int length = qMin(lineLength(line),columns);
+        memcpy(destLine, lineData(line), length*sizeof(Character));
+        for (int column = length; column < columns; column++)
+            destLine[column] = defaultChar;
 
+        // invert selected text
+        int first, last;
+        if (selectedColumns(line + history->getLines(),first,last))
+            reverseRendition(destLine + first, last-first+1);
     }
 }
 
@@ -484,9 +755,9 @@ void Screen::getImage( Character* dest, int size, int startLine, int endLine ) c
     }
 
     // mark the character at the current cursor position
-    int cursorIndex = loc(cuX, cuY + linesInHistoryBuffer);
-    if(getMode(MODE_Cursor) && cursorIndex < columns*mergedLines)
-        dest[cursorIndex].rendition |= RE_CURSOR;
+    const int cursorLine = history->getLines() + cuY - startLine;
+    if(getMode(MODE_Cursor) && cursorLine >= 0 && cursorLine < mergedLines)
+        dest[loc(qMin(cuX,columns-1), cursorLine)].rendition |= RE_CURSOR;
 }
 
 QVector<LineProperty> Screen::getLineProperties( int startLine , int endLine ) const
@@ -516,7 +787,7 @@ QVector<LineProperty> Screen::getLineProperties( int startLine , int endLine ) c
     const int firstScreenLine = startLine + linesInHistory - history->getLines();
     for (int line = firstScreenLine; line < firstScreenLine+linesInScreen; line++)
     {
-        result[index]=lineProperties[line];
+        result[index]=lineProperties[lineSlot(line)];
         index++;
     }
 
@@ -553,11 +824,13 @@ void Screen::backspace()
     cuX = qMin(columns-1,cuX); // nowrap!
     cuX = qMax(0,cuX-1);
 
-    if (screenLines[cuY].size() < cuX+1)
-        screenLines[cuY].resize(cuX+1);
+    if (lineLength(cuY) < cuX+1)
+        resizeLine(cuY,cuX+1);
+
+    markLinesChanged(cuY,cuY);
 
     if (BS_CLEARS)
-        screenLines[cuY][cuX].character = ' ';
+        lineData(cuY)[cuX].character = ' ';
 }
 
 void Screen::tab(int n)
@@ -615,15 +888,20 @@ void Screen::newLine()
 
 void Screen::checkSelection(int from, int to)
 {
-    if (selBegin == -1)
-        return;
-    int scr_TL = loc(0, history->getLines());
     //Clear entire selection if it overlaps region [from, to]
-    if ( (selBottomRight >= (from+scr_TL)) && (selTopLeft <= (to+scr_TL)) )
+    if (_selection.intersects(_screenTopLine + from/columns, from%columns,
+                              _screenTopLine + to/columns, to%columns))
         clearSelection();
 }
 
-void Screen::displayCharacter(unsigned short c)
+// konsole_wcwidth() with a shortcut for printable ASCII, which makes up
+// most of the output
+static inline int characterWidth(uint c)
+{
+    return (c >= 0x20 && c < 0x7F) ? 1 : konsole_wcwidth(c);
+}
+
+void Screen::displayCharacter(uint c)
 {
     // Note that VT100 does wrapping BEFORE putting the character.
     // This has impact on the assumption of valid cursor positions.
@@ -636,18 +914,19 @@ void Screen::displayCharacter(unsigned short c)
 
     if (cuX+w > columns) {
         if (getMode(MODE_Wrap)) {
-            lineProperties[cuY] = (LineProperty)(lineProperties[cuY] | LINE_WRAPPED);
+            lineProperties[lineSlot(cuY)] = (LineProperty)(lineProperties[lineSlot(cuY)] | LINE_WRAPPED);
             nextLine();
         }
         else
             cuX = columns-w;
     }
 
-    // ensure current line vector has enough elements
-    int size = screenLines[cuY].size();
-    if (size < cuX+w)
+    markLinesChanged(cuY,cuY);
+
+    // ensure the current line is long enough
+    if (lineLength(cuY) < cuX+w)
     {
-        screenLines[cuY].resize(cuX+w);
+        resizeLine(cuY,cuX+w);
     }
 
     if (getMode(MODE_Insert)) insertChars(w);
@@ -657,7 +936,8 @@ void Screen::displayCharacter(unsigned short c)
     // check if selection is still valid.
     checkSelection(lastPos, lastPos);
 
-    Character& currentChar = screenLines[cuY][cuX];
+    Character* line = lineData(cuY);
+    Character& currentChar = line[cuX];
 
     currentChar.character = c;
     currentChar.foregroundColor = effectiveForeground;
@@ -670,10 +950,7 @@ void Screen::displayCharacter(unsigned short c)
     {
         i++;
 
-        if ( screenLines[cuY].size() < cuX + i + 1 )
-            screenLines[cuY].resize(cuX+i+1);
-
-        Character& ch = screenLines[cuY][cuX + i];
+        Character& ch = line[cuX + i];
         ch.character = 0;
         ch.foregroundColor = effectiveForeground;
         ch.backgroundColor = effectiveBackground;
@@ -684,6 +961,81 @@ void Screen::displayCharacter(unsigned short c)
     cuX = newCursorX;
 }
 
+void Screen::displayCharacters(const uint* text, int length)
+{
+    // inserting shifts the rest of the line for every character,
+    // that is not worth optimizing
+    if (getMode(MODE_Insert))
+    {
+        for (int i = 0; i < length; i++)
+            displayCharacter(text[i]);
+        return;
+    }
+
+    // a selection can only be made between two batches, so whether the
+    // written cells have to be checked against it is decided once
+    const bool hasSelection = _selection.isValid();
+
+    int i = 0;
+    while (i < length)
+    {
+        // find the characters which fit on the rest of this line
+        int end = i;
+        int x = cuX;
+        while (end < length)
+        {
+            const int w = characterWidth(text[end]);
+            if (x + w > columns)
+                break;
+            x += qMax(w,0);
+            end++;
+        }
+
+        if (x > cuX)
+        {
+            // make the line long enough for all of them at once
+            if (lineLength(cuY) < x)
+                resizeLine(cuY,x);
+
+            if (hasSelection)
+                checkSelection(loc(cuX,cuY), loc(x-1,cuY));
+            markLinesChanged(cuY,cuY);
+
+            Character* data = lineData(cuY);
+            for (int j = i; j < end; j++)
+            {
+                int w = characterWidth(text[j]);
+                if (w <= 0)
+                    continue;
+
+                lastPos = loc(cuX,cuY);
+
+                Character& currentChar = data[cuX++];
+                currentChar.character = text[j];
+                currentChar.foregroundColor = effectiveForeground;
+                currentChar.backgroundColor = effectiveBackground;
+                currentChar.rendition = effectiveRendition;
+
+                // the right half of a double-width character
+                while (--w)
+                {
+                    Character& ch = data[cuX++];
+                    ch.character = 0;
+                    ch.foregroundColor = effectiveForeground;
+                    ch.backgroundColor = effectiveBackground;
+                    ch.rendition = effectiveRendition;
+                }
+            }
+        }
+        i = end;
+
+        // the next character does not fit on this line, leave wrapping
+        // (or overwriting the end of the line) to displayCharacter()
+        if (i < length)
+            displayCharacter(text[i++]);
+    }
+}
+
 void Screen::compose(QString /*compose*/)
 {
     Q_ASSERT( 0 /*Not implemented yet*/ );
@@ -717,8 +1069,10 @@ void Screen::resetScrolledLines()
 void Screen::scrollUp(int n)
 {
     if (n == 0) n = 1; // Default
-    if (_topMargin == 0) addHistLine(); // history.history
-    scrollUp(_topMargin, n);
+    if (_topMargin == 0)
+        scrollUpIntoHistory(n);
+    else
+        scrollUp(_topMargin, n);
 }
 
 QRect Screen::lastScrolledRegion() const
@@ -728,13 +1082,48 @@ QRect Screen::lastScrolledRegion() const
 
 void Screen::scrollUp(int from, int n)
 {
-    if (n <= 0 || from + n > _bottomMargin) return;
+    // scrolling by the height of the region or more clears all of it
+    n = qMin(n,_bottomMargin-from+1);
+    if (n <= 0) return;
+
+    // the selection follows the lines which move up
+    if (from + n <= _bottomMargin)
+        moveSelection(from+n,_bottomMargin,-n);
+    scrollLinesUp(from,n);
+}
+
+void Screen::scrollUpIntoHistory(int n)
+{
+    // every line of the region goes to the history, even if that is
+    // fewer than 'n'
+    n = qMin(n,_bottomMargin+1);
+    if (n <= 0) return;
 
+    for (int y = 0; y < n; y++)
+        addHistLine(y);
+
+    // the lines below the region stay where they are, so their absolute
+    // line numbers change once the top of the screen moves on
+    if (_bottomMargin < lines-1)
+        moveSelection(_bottomMargin+1,lines-1,n);
+    _screenTopLine += n;
+
+    // the selection may have dropped out of the history altogether
+    if (_selection.isValid() && _selection.bottomLine() < absoluteLine(0))
+        clearSelection();
+
+    scrollLinesUp(0,n);
+}
+
+void Screen::scrollLinesUp(int from, int n)
+{
     _scrolledLines -= n;
     _lastScrolledRegion = QRect(0,_topMargin,columns-1,(_bottomMargin-_topMargin));
 
     //FIXME: make sure `topMargin', `bottomMargin', `from', `n' is in bounds.
-    moveImage(loc(0,from),loc(0,from+n),loc(columns-1,_bottomMargin));
+    // when all the lines from 'from' on scroll out there is nothing to move
+    if (from + n <= _bottomMargin)
+        moveImage(loc(0,from),loc(0,from+n),loc(columns-1,_bottomMargin));
     clearImage(loc(0,_bottomMargin-n+1),loc(columns-1,_bottomMargin),' ');
 }
 
@@ -755,6 +1144,8 @@ void Screen::scrollDown(int from, int n)
         return;
     if (from + n > _bottomMargin)
         n = _bottomMargin - from;
+    // the selection follows the lines which move down
+    moveSelection(from,_bottomMargin-n,n);
     moveImage(loc(0,from+n),loc(0,from),loc(columns-1,_bottomMargin-n));
     clearImage(loc(0,from),loc(columns-1,from+n-1),' ');
 }
@@ -801,11 +1192,11 @@ int Screen::getCursorY() const
 
 void Screen::clearImage(int loca, int loce, char c)
 { 
-    int scr_TL=loc(0,history->getLines());
     //FIXME: check positions
 
     //Clear entire selection if it overlaps region to be moved...
-    if ( (selBottomRight > (loca+scr_TL) )&&(selTopLeft < (loce+scr_TL)) )
+    if (_selection.intersects(_screenTopLine + loca/columns, loca%columns,
+                              _screenTopLine + loce/columns, loce%columns))
     {
         clearSelection();
     }
@@ -819,25 +1210,28 @@ void Screen::clearImage(int loca, int loce, char c)
     //default character, the affected lines can simply be shrunk.
     bool isDefaultCh = (clearCh == Character());
 
+    markLinesChanged(topLine,bottomLine);
+
     for (int y=topLine;y<=bottomLine;y++)
     {
-        lineProperties[y] = 0;
+        lineProperties[lineSlot(y)] = 0;
 
         int endCol = ( y == bottomLine) ? loce%columns : columns-1;
         int startCol = ( y == topLine ) ? loca%columns : 0;
 
-        QVector<Character>& line = screenLines[y];
-
         if ( isDefaultCh && endCol == columns-1 )
         {
-            line.resize(startCol);
+            if (lineLength(y) > startCol)
+                _lineLengths[lineSlot(y)] = startCol;
+            else
+                resizeLine(y,startCol);
         }
         else
         {
-            if (line.size() < endCol + 1)
-                line.resize(endCol+1);
+            if (lineLength(y) < endCol + 1)
+                resizeLine(y,endCol+1);
 
-            Character* data = line.data();
+            Character* data = lineData(y);
             for (int i=startCol;i<=endCol;i++)
                 data[i]=clearCh;
         }
@@ -851,26 +1245,16 @@ void Screen::moveImage(int dest, int sourceBegin, int sourceEnd)
     int lines=(sourceEnd-sourceBegin)/columns;
 
     //move screen image and line properties:
-    //the source and destination areas of the image may overlap,
-    //so it matters that we do the copy in the right order -
-    //forwards if dest < sourceBegin or backwards otherwise.
-    //(search the web for 'memmove implementation' for details)
-    if (dest < sourceBegin)
-    {
-        for (int i=0;i<=lines;i++)
-        {
-            screenLines[ (dest/columns)+i ] = screenLines[ (sourceBegin/columns)+i ];
-            lineProperties[(dest/columns)+i]=lineProperties[(sourceBegin/columns)+i];
-        }
-    }
-    else
-    {
-        for (int i=lines;i>=0;i--)
-        {
-            screenLines[ (dest/columns)+i ] = screenLines[ (sourceBegin/columns)+i ];
-            lineProperties[(dest/columns)+i]=lineProperties[(sourceBegin/columns)+i];
-        }
-    }
+    //rather than copying the lines, the range spanned by the source and
+    //destination areas is rotated.  This leaves the lines which would have
+    //been overwritten in the area vacated by the move, which the caller
+    //clears afterwards.
+    const int destLine = dest/columns;
+    const int sourceLine = sourceBegin/columns;
+    if (destLine < sourceLine)
+        rotateLines(destLine, sourceLine+lines, sourceLine-destLine);
+    else if (destLine > sourceLine)
+        rotateLines(sourceLine, destLine+lines, sourceLine-destLine);
 
     if (lastPos != -1)
     {
@@ -879,43 +1263,47 @@ void Screen::moveImage(int dest, int sourceBegin, int sourceEnd)
         if ((lastPos < 0) || (lastPos >= (lines*columns)))
             lastPos = -1;
     }
+}
 
-    // Adjust selection to follow scroll.
-    if (selBegin != -1)
-    {
-        bool beginIsTL = (selBegin == selTopLeft);
-        int diff = dest - sourceBegin; // Scroll by this amount
-        int scr_TL=loc(0,history->getLines());
-        int srca = sourceBegin+scr_TL; // Translate index from screen to global
-        int srce = sourceEnd+scr_TL; // Translate index from screen to global
-        int desta = srca+diff;
-        int deste = srce+diff;
-
-        if ((selTopLeft >= srca) && (selTopLeft <= srce))
-            selTopLeft += diff;
-        else if ((selTopLeft >= desta) && (selTopLeft <= deste))
-            selBottomRight = -1; // Clear selection (see below)
-
-        if ((selBottomRight >= srca) && (selBottomRight <= srce))
-            selBottomRight += diff;
-        else if ((selBottomRight >= desta) && (selBottomRight <= deste))
-            selBottomRight = -1; // Clear selection (see below)
-
-        if (selBottomRight < 0)
-        {
-            clearSelection();
-        }
-        else
-        {
-            if (selTopLeft < 0)
-                selTopLeft = 0;
-        }
+void Screen::moveSelection(int top, int bottom, int delta)
+{
+    if (!_selection.isValid())
+        return;
 
-        if (beginIsTL)
-            selBegin = selTopLeft;
-        else
-            selBegin = selBottomRight;
+    _selection.moveLines(_screenTopLine+top,_screenTopLine+bottom,delta);
+    if (!_selection.isValid())
+        markImageChanged();
+}
+
+void Screen::rotateLines(int top, int bottom, int n)
+{
+    const int count = bottom-top+1;
+    n %= count;
+    if (n < 0)
+        n += count;
+    if (n == 0)
+        return;
+
+    markLinesChanged(top,bottom);
+
+    // scrolling the whole screen just moves the start of the ring
+    if (top == 0 && bottom == lines-1)
+    {
+        _lineBase = (_lineBase+n) % lines;
+        return;
     }
+
+    // otherwise rotate the region in place by reversing both parts and
+    // then the whole region, each step swaps two lines without copying them
+    reverseLines(top, top+n-1);
+    reverseLines(top+n, bottom);
+    reverseLines(top, bottom);
+}
+
+void Screen::reverseLines(int top, int bottom)
+{
+    for (; top < bottom; top++, bottom--)
+        qSwap(_lineSlots[(top+_lineBase) % lines], _lineSlots[(bottom+_lineBase) % lines]);
 }
 
 void Screen::clearToEndOfScreen()
@@ -931,12 +1319,12 @@ void Screen::clearToBeginOfScreen()
 void Screen::clearEntireScreen()
 {
     // Add entire screen to history
-    for (int i = 0; i < (lines-1); i++)
-    {
-        addHistLine(); scrollUp(0,1);
-    }
+    scrollUpIntoHistory(lines-1);
 
     clearImage(loc(0,0),loc(columns-1,lines-1),' ');
+
+    // the colors of the screen may have become unused
+    _rgbReclaimDeferred = 0;
 }
 
 /*! fill screen with 'E'
@@ -985,7 +1373,7 @@ void Screen::setDefaultRendition()
 
 void Screen::setForeColor(int space, int color)
 {
-    currentForeground = CharacterColor(space, color);
+    currentForeground = makeColor(space, color);
 
     if ( currentForeground.isValid() )
         updateEffectiveRendition();
@@ -995,7 +1383,7 @@ void Screen::setForeColor(int space, int color)
 
 void Screen::setBackColor(int space, int color)
 {
-    currentBackground = CharacterColor(space, color);
+    currentBackground = makeColor(space, color);
 
     if ( currentBackground.isValid() )
         updateEffectiveRendition();
@@ -1003,19 +1391,116 @@ void Screen::setBackColor(int space, int color)
         setBackColor(COLOR_SPACE_DEFAULT,DEFAULT_BACK_COLOR);
 }
 
+CharacterColor Screen::makeColor(int space, int color)
+{
+    CharacterColor result(space, color, &_rgbColors);
+    if (space == COLOR_SPACE_RGB && result.rgbIndex() < 0)
+    {
+        // when all the colors are still in use, eg. in an unlimited history,
+        // scanning for unused ones on every new color would be very slow
+        if (_rgbReclaimDeferred > 0 && history->firstSourceLine() == _rgbReclaimFirstLine)
+        {
+            _rgbReclaimDeferred--;
+            return result;
+        }
+
+        reclaimRgbColors();
+        result = CharacterColor(space, color, &_rgbColors);
+    }
+    return result;
+}
+
+void Screen::reclaimRgbColors()
+{
+    QBitArray used(RgbColorTable::Capacity);
+
+    // the colors of the characters on the screen and the ones which are
+    // going to be used for the next characters
+    const CharacterColor colors[] = { currentForeground, currentBackground,
+                                      effectiveForeground, effectiveBackground,
+                                      savedState.foreground, savedState.background };
+    for (int i = 0; i < 6; i++)
+    {
+        if (colors[i].rgbIndex() >= 0)
+            used.setBit(colors[i].rgbIndex());
+    }
+
+    for (int y = 0; y < lines; y++)
+    {
+        const Character* data = lineData(y);
+        const int length = lineLength(y);
+        for (int x = 0; x < length; x++)
+        {
+            if (data[x].foregroundColor.rgbIndex() >= 0)
+                used.setBit(data[x].foregroundColor.rgbIndex());
+            if (data[x].backgroundColor.rgbIndex() >= 0)
+                used.setBit(data[x].backgroundColor.rgbIndex());
+        }
+    }
+
+    // the colors of the lines which are still in the history
+    if (!_rgbHistoryLines.isEmpty())
+    {
+        const qint64 firstLine = history->firstSourceLine();
+        for (int i = 0; i < RgbColorTable::Capacity; i++)
+        {
+            if (_rgbHistoryLines.at(i) >= firstLine)
+                used.setBit(i);
+        }
+    }
+
+    const int oldCount = _rgbColors.count();
+    _rgbColors.reclaim(used);
+
+    // wait until another reclaim could pay for the scan
+    const bool worthwhile = oldCount - _rgbColors.count() >= RgbColorTable::Capacity / 16;
+    _rgbReclaimDeferred = worthwhile ? 0 : RgbColorTable::Capacity;
+    _rgbReclaimFirstLine = history->firstSourceLine();
+}
+
+void Screen::addHistoryColors(const Character* cells, int count)
+{
+    if (_rgbColors.count() == 0)
+        return;
+
+    if (_rgbHistoryLines.isEmpty())
+        _rgbHistoryLines.fill(-1, RgbColorTable::Capacity);
+
+    const qint64 line = history->endSourceLine() - 1;
+    for (int i = 0; i < count; i++)
+    {
+        const int foreground = cells[i].foregroundColor.rgbIndex();
+        if (foreground >= 0)
+            _rgbHistoryLines[foreground] = line;
+        const int background = cells[i].backgroundColor.rgbIndex();
+        if (background >= 0)
+            _rgbHistoryLines[background] = line;
+    }
+}
+
 void Screen::clearSelection() 
 {
-    selBottomRight = -1;
-    selTopLeft = -1;
-    selBegin = -1;
+    if (_selection.isValid())
+        markImageChanged();
+
+    _selection.clear();
 }
 
 void Screen::getSelectionStart(int& column , int& line) const
 {
-    if ( selTopLeft != -1 )
+    if ( isSelectionValid() )
     {
-        column = selTopLeft % columns;
-        line = selTopLeft / columns;
+        const qint64 firstLine = absoluteLine(0);
+        column = _selection.topColumn();
+        line = int(_selection.topLine() - firstLine);
+
+        // the start of the selection has dropped out of the history
+        if (line < 0)
+        {
+            line = 0;
+            if (!_selection.isBlockMode())
+                column = 0;
+        }
     }
     else
     {
@@ -1025,10 +1510,10 @@ void Screen::getSelectionStart(int& column , int& line) const
 }
 void Screen::getSelectionEnd(int& column , int& line) const
 {
-    if ( selBottomRight != -1 )
+    if ( isSelectionValid() )
     {
-        column = selBottomRight % columns;
-        line = selBottomRight / columns;
+        column = _selection.bottomColumn();
+        line = int(_selection.bottomLine() - absoluteLine(0));
     }
     else
     {
@@ -1038,61 +1523,31 @@ void Screen::getSelectionEnd(int& column , int& line) const
 }
 void Screen::setSelectionStart(const int x, const int y, const bool mode)
 {
-    selBegin = loc(x,y);
     /* FIXME, HACK to correct for x too far to the right... */
-    if (x == columns) selBegin--;
+    _selection.setStart(absoluteLine(y), (x == columns) ? x-1 : x, mode);
 
-    selBottomRight = selBegin;
-    selTopLeft = selBegin;
-    blockSelectionMode = mode;
+    markImageChanged();
 }
 
 void Screen::setSelectionEnd( const int x, const int y)
 {
-    if (selBegin == -1)
+    if (!_selection.isValid())
         return;
 
-    int endPos =  loc(x,y);
+    markImageChanged();
 
-    if (endPos < selBegin)
-    {
-        selTopLeft = endPos;
-        selBottomRight = selBegin;
-    }
-    else
-    {
-        /* FIXME, HACK to correct for x too far to the right... */
-        if (x == columns)
-            endPos--;
-
-        selTopLeft = selBegin;
-        selBottomRight = endPos;
-    }
-
-    // Normalize the selection in column mode
-    if (blockSelectionMode)
-    {
-        int topRow = selTopLeft / columns;
-        int topColumn = selTopLeft % columns;
-        int bottomRow = selBottomRight / columns;
-        int bottomColumn = selBottomRight % columns;
-
-        selTopLeft = loc(qMin(topColumn,bottomColumn),topRow);
-        selBottomRight = loc(qMax(topColumn,bottomColumn),bottomRow);
-    }
+    /* FIXME, HACK to correct for x too far to the right... */
+    _selection.setEnd(absoluteLine(y), (x == columns) ? x-1 : x);
 }
 
 bool Screen::isSelected( const int x,const int y) const
 {
-    bool columnInSelection = true;
-    if (blockSelectionMode)
-    {
-        columnInSelection = x >= (selTopLeft % columns) &&
-                x <= (selBottomRight % columns);
-    }
+    return _selection.contains(absoluteLine(y), x);
+}
 
-    int pos = loc(x,y);
-    return pos >= selTopLeft && pos <= selBottomRight && columnInSelection;
+bool Screen::selectedColumns(int line, int& first, int& last) const
+{
+    return _selection.columns(absoluteLine(line), columns, first, last);
 }
 
 QString Screen::selectedText(bool preserveLineBreaks) const
@@ -1110,7 +1565,7 @@ QString Screen::selectedText(bool preserveLineBreaks) const
 
 bool Screen::isSelectionValid() const
 {
-    return selTopLeft >= 0 && selBottomRight >= 0;
+    return _selection.isValid() && _selection.bottomLine() >= absoluteLine(0);
 }
 
 void Screen::writeSelectionToStream(TerminalCharacterDecoder* decoder , 
@@ -1118,28 +1573,27 @@ void Screen::writeSelectionToStream(TerminalCharacterDecoder* decoder ,
 {
     if (!isSelectionValid())
         return;
-    writeToStream(decoder,selTopLeft,selBottomRight,preserveLineBreaks);
+
+    int left, top, right, bottom;
+    getSelectionStart(left,top);
+    getSelectionEnd(right,bottom);
+    writeToStream(decoder,top,left,bottom,right,
+                  _selection.isBlockMode(),preserveLineBreaks);
 }
 
 void Screen::writeToStream(TerminalCharacterDecoder* decoder, 
-                           int startIndex, int endIndex,
-                           bool preserveLineBreaks) const
+                           int top, int left, int bottom, int right,
+                           bool blockMode, bool preserveLineBreaks) const
 {
-    int top = startIndex / columns;
-    int left = startIndex % columns;
-
-    int bottom = endIndex / columns;
-    int right = endIndex % columns;
-
     Q_ASSERT( top >= 0 && left >= 0 && bottom >= 0 && right >= 0 );
 
     for (int y=top;y<=bottom;y++)
     {
         int start = 0;
-        if ( y == top || blockSelectionMode ) start = left;
+        if ( y == top || blockMode ) start = left;
 
         int count = -1;
-        if ( y == bottom || blockSelectionMode ) count = right - start + 1;
+        if ( y == bottom || blockMode ) count = right - start + 1;
 
         const bool appendNewLine = ( y != bottom );
         int copied = copyLineToStream( y,
@@ -1220,8 +1674,8 @@ int Screen::copyLineToStream(int line ,
 
         const int screenLine = line-history->getLines();
 
-        Character* data = screenLines[screenLine].data();
-        int length = screenLines[screenLine].count();
+        const Character* data = lineData(screenLine);
+        int length = lineLength(screenLine);
 
         //retrieve line from screen image
         for (int i=start;i < qMin(start+count,length);i++)
@@ -1233,7 +1687,7 @@ int Screen::copyLineToStream(int line ,
         count = qBound(0,count,length-start);
 
         Q_ASSERT( screenLine < lineProperties.count() );
-        currentLineProperties |= lineProperties[screenLine];
+        currentLineProperties |= lineProperties[lineSlot(screenLine)];
     }
 
     // add new line character at end
@@ -1255,66 +1709,30 @@ int Screen::copyLineToStream(int line ,
 
 void Screen::writeLinesToStream(TerminalCharacterDecoder* decoder, int fromLine, int toLine) const
 {
-    writeToStream(decoder,loc(0,fromLine),loc(columns-1,toLine));
+    writeToStream(decoder,fromLine,0,toLine,columns-1,false);
 }
 
-void Screen::addHistLine()
+void Screen::addHistLine(int y)
 {
-    // add line to history buffer
-    // we have to take care about scrolling, too...
-
     if (hasScroll())
     {
-        int oldHistLines = history->getLines();
-
-        history->addCellsVector(screenLines[0]);
-        history->addLine( lineProperties[0] & LINE_WRAPPED );
-
-        int newHistLines = history->getLines();
-
-        bool beginIsTL = (selBegin == selTopLeft);
-
-        // If the history is full, increment the count
-        // of dropped lines
-        if ( newHistLines == oldHistLines )
-            _droppedLines++;
-
-        // Adjust selection for the new point of reference
-        if (newHistLines > oldHistLines)
-        {
-            if (selBegin != -1)
-            {
-                selTopLeft += columns;
-                selBottomRight += columns;
-            }
-        }
-
-        if (selBegin != -1)
-        {
-            // Scroll selection in history up
-            int top_BR = loc(0, 1+newHistLines);
-
-            if (selTopLeft < top_BR)
-                selTopLeft -= columns;
+        // the lines of the history which are visible in a view move up
+        markImageChanged();
 
-            if (selBottomRight < top_BR)
-                selBottomRight -= columns;
-
-            if (selBottomRight < 0)
-                clearSelection();
-            else
-            {
-                if (selTopLeft < 0)
-                    selTopLeft = 0;
-            }
+        int oldHistLines = history->getLines();
 
-            if (beginIsTL)
-                selBegin = selTopLeft;
-            else
-                selBegin = selBottomRight;
-        }
+        // trailing blanks are not kept, see textLength(), so that the line
+        // can be wrapped at a smaller width later without blank lines
+        const bool wrapped = lineProperties[lineSlot(y)] & LINE_WRAPPED;
+        const int length = wrapped ? lineLength(y) : textLength(y);
+        history->addCells(lineData(y), length);
+        history->addLine(wrapped);
+        addHistoryColors(lineData(y), length);
+
+        // If the history is full, count the lines which
+        // dropped out of it to make room for the new one
+        _droppedLines += oldHistLines + 1 - history->getLines();
     }
-
 }
 
 int Screen::getHistLines() const
@@ -1325,13 +1743,13 @@ int Screen::getHistLines() const
 void Screen::setScroll(const HistoryType& t , bool copyPreviousScroll)
 {
     clearSelection();
+    markImageChanged();
 
     if ( copyPreviousScroll )
-        history = t.scroll(history);
+        history->setSource(t.scroll(history->source()));
     else
     {
-        HistoryScroll* oldScroll = history;
-        history = t.scroll(0);
+        HistoryScroll* oldScroll = history->setSource(t.scroll(0));
         delete oldScroll;
     }
 }
@@ -1343,15 +1761,22 @@ bool Screen::hasScroll() const
 
 const HistoryType& Screen::getScroll() const
 {
-    return history->getType();
+    return history->source()->getType();
+}
+
+const RgbColorTable* Screen::rgbColorTable() const
+{
+    return &_rgbColors;
 }
 
 void Screen::setLineProperty(LineProperty property , bool enable)
 {
+    markLinesChanged(cuY,cuY);
+
     if ( enable )
-        lineProperties[cuY] = (LineProperty)(lineProperties[cuY] | property);
+        lineProperties[lineSlot(cuY)] = (LineProperty)(lineProperties[lineSlot(cuY)] | property);
     else
-        lineProperties[cuY] = (LineProperty)(lineProperties[cuY] & ~property);
+        lineProperties[lineSlot(cuY)] = (LineProperty)(lineProperties[lineSlot(cuY)] & ~property);
 }
 void Screen::fillWithDefaultChar(Character* dest, int count)
 {
@@ -32,6 +32,7 @@
 // Own includes
 #include "character.h"
 #include "history.h"
+#include "screenselection.h"
 #define MODE_Origin    0
 #define MODE_Wrap      1
 #define MODE_Insert    2
@@ -342,7 +343,19 @@ public:
      * is inserted at the current cursor position, otherwise it will replace the
      * character already at the current cursor position.
      */
-    void displayCharacter(unsigned short c);
+    void displayCharacter(uint c);
+
+    /**
+     * Displays a run of characters starting at the current cursor position.
+     *
+     * This has the same effect as calling displayCharacter() for each
+     * character in @p text, but writes every stretch of characters which
+     * fits on the current line in one go, including double-width ones.
+     *
+     * @param text The unicode code points of the characters to display.
+     * @param length The number of characters in @p text.
+     */
+    void displayCharacters(const uint* text, int length);
     
     // Do composition with last shown character FIXME: Not implemented yet for KDE 4
     void compose(QString compose);
@@ -378,6 +391,27 @@ public:
      * other attributes control the size of characters in the line.
      */
     QVector<LineProperty> getLineProperties( int startLine , int endLine ) const;
+
+    /**
+     * Returns the current change generation of the screen and starts a new one.
+     *
+     * Every change to the screen image is stamped with the generation which is
+     * current at the time.  A view which records the value returned by this
+     * method can later find out which lines have changed since, by comparing
+     * lineGeneration() and imageGeneration() against the recorded value.
+     */
+    quint64 nextGeneration()
+    { return _generation++; }
+    /** Returns the generation in which screen line @p line was last changed. */
+    quint64 lineGeneration(int line) const
+    { return _lineGenerations[line]; }
+    /**
+     * Returns the generation of the last change which affects the whole image
+     * rather than individual screen lines, such as a change of the selection,
+     * of the history or of the size of the screen.
+     */
+    quint64 imageGeneration() const
+    { return _imageGeneration; }
     
 
     /** Return the number of lines. */
@@ -388,6 +422,17 @@ public:
     { return columns; }
     /** Return the number of lines in the history buffer. */
     int getHistLines() const;
+    /**
+     * Specifies whether wrapped lines are joined and wrapped again at the new
+     * width when the number of columns of the screen changes.
+     *
+     * Lines which no longer fit on the screen after reflowing are moved into
+     * the history.  The lines which are already in a history kept in memory
+     * are wrapped at the new width as they are read, see HistoryScrollReflow.
+     */
+    void setReflowLines(bool enable);
+    /** Returns whether lines are reflowed on resize, see setReflowLines() */
+    bool reflowLines() const;
     /**
      * Sets the type of storage used to keep lines in the history.
      * If @p copyPreviousScroll is true then the contents of the previous
@@ -396,6 +441,11 @@ public:
     void setScroll(const HistoryType& , bool copyPreviousScroll = true);
     /** Returns the type of storage used to keep lines in the history. */
     const HistoryType& getScroll() const;
+    /**
+     * Returns the table of the RGB colors which the characters of this screen
+     * and its history refer to, see CharacterColor::color()
+     */
+    const RgbColorTable* rgbColorTable() const;
     /**
      * Returns true if this screen keeps lines that are scrolled off the screen
      * in a history buffer.
@@ -583,27 +633,119 @@ private:
       */
     void moveImage(int dest, int sourceBegin, int sourceEnd);
 
+    /**
+      * rotates the screen lines between 'top' and 'bottom' (inclusive) up by
+      * 'n' lines, or down if 'n' is negative.  The lines themselves are not
+      * copied: rotating the whole screen only moves the start of the ring of
+      * screen lines, rotating a scroll region swaps the lines within it.
+      */
+    void rotateLines(int top, int bottom, int n);
+    // reverses the order of the screen lines between 'top' and 'bottom'
+    void reverseLines(int top, int bottom);
+
+    /**
+      * returns the slot of screen line 'y' in the line arena, which is also
+      * its index in _lineLengths and lineProperties.
+      *
+      * The slots of the screen lines form a ring which starts at _lineBase,
+      * so that scrolling the whole screen does not need to move any lines.
+      */
+    int lineSlot(int y) const
+    { const int index = y + _lineBase; return _lineSlots[index < lines ? index : index - lines]; }
+
+    /** returns the characters of screen line 'y' */
+    Character* lineData(int y)
+    { return screenLines + lineSlot(y)*_lineStride; }
+    const Character* lineData(int y) const
+    { return screenLines + lineSlot(y)*_lineStride; }
+
+    /** returns the number of characters in use on screen line 'y' */
+    int lineLength(int y) const
+    { return _lineLengths[lineSlot(y)]; }
+
+    /**
+      * sets the number of characters in use on screen line 'y' to 'length',
+      * filling any characters added to the line with the default character.
+      */
+    void resizeLine(int y, int length);
+
+    // stamps screen lines 'top' to 'bottom' with the current generation
+    void markLinesChanged(int top, int bottom)
+    { for (int y = top; y <= bottom; y++) _lineGenerations[y] = _generation; }
+    // stamps the whole image with the current generation
+    void markImageChanged()
+    { _imageGeneration = _generation; }
+
+    // resizes the screen, rewrapping the lines at the new width
+    void reflowImage(int new_lines, int new_columns);
+    // returns the length of screen line 'y' without trailing blanks
+    int textLength(int y) const;
+
     /** scroll up 'i' lines in current region, clearing the bottom 'i' lines */
     void scrollUp(int from, int i);
 
+    /**
+      * moves the top 'n' lines of the screen into the history and scrolls
+      * up the rest of the current region, which must start at the top of the
+      * screen.  The lines keep their absolute line numbers, so unlike
+      * scrollUp() this does not need to adjust the selection.
+      */
+    void scrollUpIntoHistory(int n);
+
+    // moves the lines of the current region up or down without touching the selection
+    void scrollLinesUp(int from, int n);
+
     /** scroll down 'i' lines in current region, clearing the top 'i' lines */
     void scrollDown(int from, int i);
 
-    void addHistLine();
+    // adds screen line 'y' to the history
+    void addHistLine(int y);
+    // notes the RGB colors of the line which was just added to the history
+    void addHistoryColors(const Character* cells, int count);
+
+    // returns the color 'color' of color space 'space', reclaiming the
+    // unused RGB colors first if the table is full and that is likely to
+    // free some
+    CharacterColor makeColor(int space, int color);
+    // gives the RGB colors which neither the screen nor the history uses
+    // back to the table
+    void reclaimRgbColors();
+
+    /**
+      * returns the absolute line number of 'line', where 0 is the first line
+      * in the history.  See ScreenSelection.
+      */
+    qint64 absoluteLine(int line) const
+    { return _screenTopLine - history->getLines() + line; }
+
+    // moves the ends of the selection in screen lines 'top' to 'bottom' by 'delta' lines
+    void moveSelection(int top, int bottom, int delta);
 
     void initTabStops();
 
     void updateEffectiveRendition();
     void reverseRendition(Character& p) const;
+    // swaps the foreground and background colors of 'count' characters
+    void reverseRendition(Character* p, int count) const;
+
+    /**
+      * finds the columns of 'line' which are selected, where 0 is the first
+      * line in the history.  Returns false if no part of the line is
+      * selected, otherwise the selected columns are 'first' to 'last'.
+      */
+    bool selectedColumns(int line, int& first, int& last) const;
 
     bool isSelectionValid() const;
 
     /**
-      * copies text from 'startIndex' to 'endIndex' to a stream
-      * startIndex and endIndex are positions generated using the loc(x,y) macro
+      * copies text from column 'left' of line 'top' to column 'right' of line
+      * 'bottom' to a stream, one line at a time.  The lines are numbered from
+      * 0, the first line in the history.  If 'blockMode' is true only the
+      * columns from 'left' to 'right' of each line are copied.
       */
-    void writeToStream(TerminalCharacterDecoder* decoder, int startIndex,
-                       int endIndex, bool preserveLineBreaks = true) const;
+    void writeToStream(TerminalCharacterDecoder* decoder,
+                       int top, int left, int bottom, int right,
+                       bool blockMode, bool preserveLineBreaks = true) const;
 
     /**
       * copies 'count' lines from the screen buffer into 'dest',
@@ -622,18 +764,42 @@ private:
     int lines;
     int columns;
 
-    typedef QVector<Character> ImageLine;      // [0..columns]
-    ImageLine*          screenLines;    // [lines]
+    // the screen lines are stored in one contiguous arena of _lineCapacity
+    // slots, each _lineStride characters wide.  The stride only ever grows,
+    // so that narrowing the screen and widening it again keeps the lines.
+    Character*          screenLines;    // [_lineCapacity*_lineStride]
+    int                 _lineStride;
+    int                 _lineCapacity;
+    QVarLengthArray<int,64> _lineLengths;  // [_lineCapacity]
+    QVarLengthArray<int,64> _lineSlots;    // [lines], a ring starting at _lineBase
+    int                 _lineBase;
 
     int _scrolledLines;
     QRect _lastScrolledRegion;
 
     int _droppedLines;
 
-    QVarLengthArray<LineProperty,64> lineProperties;
+    // change tracking, see nextGeneration()
+    quint64 _generation;
+    quint64 _imageGeneration;
+    QVarLengthArray<quint64,64> _lineGenerations;  // [lines]
+
+    bool _reflowLines;
+
+    QVarLengthArray<LineProperty,64> lineProperties;  // [_lineCapacity]
     
     // history buffer ---------------
-    HistoryScroll* history;
+    HistoryScrollReflow* history;
+
+    // RGB colors, with the number of the last line in the history which
+    // uses each, see HistoryScrollReflow::firstSourceLine()
+    RgbColorTable _rgbColors;
+    QVector<qint64> _rgbHistoryLines;  // [RgbColorTable::Capacity] once used
+    // a reclaim which freed hardly any colors is not repeated for the next
+    // _rgbReclaimDeferred misses, unless lines leave the history (which
+    // then no longer starts at _rgbReclaimFirstLine) or the screen is cleared
+    int _rgbReclaimDeferred;
+    qint64 _rgbReclaimFirstLine;
     
     // cursor location
     int cuX;
@@ -657,10 +823,8 @@ private:
     QBitArray tabStops;
 
     // selection -------------------
-    int selBegin; // The first location selected.
-    int selTopLeft;    // TopLeft Location.
-    int selBottomRight;    // Bottom Right Location.
-    bool blockSelectionMode;  // Column selection mode
+    ScreenSelection _selection;
+    qint64 _screenTopLine;  // absolute line number of the top line of the screen
 
     // effective colors and rendition ------------
     CharacterColor effectiveForeground; // These are derived from
@@ -0,0 +1,158 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+// Own includes
+#include "screenselection.h"
+
+// returns true if the position at 'column' in 'line' comes before the one at
+// 'otherColumn' in 'otherLine'
+static inline bool isBefore(qint64 line, int column, qint64 otherLine, int otherColumn)
+{
+    return line < otherLine || (line == otherLine && column < otherColumn);
+}
+
+ScreenSelection::ScreenSelection()
+    : _beginLine(0), _beginColumn(0),
+      _endLine(0), _endColumn(0),
+      _topLine(0), _topColumn(0),
+      _bottomLine(0), _bottomColumn(0),
+      _blockMode(false),
+      _valid(false)
+{
+}
+
+void ScreenSelection::clear()
+{
+    _valid = false;
+}
+
+void ScreenSelection::setStart(qint64 line, int column, bool blockMode)
+{
+    _beginLine = _endLine = line;
+    _beginColumn = _endColumn = column;
+    _blockMode = blockMode;
+    _valid = true;
+    normalize();
+}
+
+void ScreenSelection::setEnd(qint64 line, int column)
+{
+    if (!_valid)
+        return;
+
+    _endLine = line;
+    _endColumn = column;
+    normalize();
+}
+
+void ScreenSelection::normalize()
+{
+    if (_blockMode)
+    {
+        _topLine = qMin(_beginLine,_endLine);
+        _bottomLine = qMax(_beginLine,_endLine);
+        _topColumn = qMin(_beginColumn,_endColumn);
+        _bottomColumn = qMax(_beginColumn,_endColumn);
+    }
+    else if (isBefore(_endLine,_endColumn,_beginLine,_beginColumn))
+    {
+        _topLine = _endLine;
+        _topColumn = _endColumn;
+        _bottomLine = _beginLine;
+        _bottomColumn = _beginColumn;
+    }
+    else
+    {
+        _topLine = _beginLine;
+        _topColumn = _beginColumn;
+        _bottomLine = _endLine;
+        _bottomColumn = _endColumn;
+    }
+}
+
+bool ScreenSelection::columns(qint64 line, int columnCount, int& first, int& last) const
+{
+    if (!_valid || line < _topLine || line > _bottomLine)
+        return false;
+
+    if (_blockMode)
+    {
+        first = _topColumn;
+        last = _bottomColumn;
+    }
+    else
+    {
+        first = (line == _topLine) ? _topColumn : 0;
+        last = (line == _bottomLine) ? _bottomColumn : columnCount-1;
+    }
+
+    first = qMax(first,0);
+    last = qMin(last,columnCount-1);
+    return first <= last;
+}
+
+bool ScreenSelection::contains(qint64 line, int column) const
+{
+    if (!_valid || line < _topLine || line > _bottomLine)
+        return false;
+
+    if (_blockMode)
+        return column >= _topColumn && column <= _bottomColumn;
+
+    return !isBefore(line,column,_topLine,_topColumn) &&
+           !isBefore(_bottomLine,_bottomColumn,line,column);
+}
+
+bool ScreenSelection::intersects(qint64 startLine, int startColumn,
+                                 qint64 endLine, int endColumn) const
+{
+    return _valid &&
+           !isBefore(_bottomLine,_bottomColumn,startLine,startColumn) &&
+           !isBefore(endLine,endColumn,_topLine,_topColumn);
+}
+
+void ScreenSelection::moveLines(qint64 first, qint64 last, int delta)
+{
+    if (!_valid || delta == 0)
+        return;
+
+    qint64* ends[2] = { &_beginLine, &_endLine };
+    for (int i = 0; i < 2; i++)
+    {
+        qint64& line = *ends[i];
+        if (line >= first && line <= last)
+        {
+            line += delta;
+        }
+        else if (line >= first+delta && line <= last+delta)
+        {
+            // the text under this end of the selection is overwritten
+            clear();
+            return;
+        }
+    }
+
+    normalize();
+}
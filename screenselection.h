@@ -0,0 +1,124 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#pragma once
+
+// Qt includes
+#include <QtGlobal>
+
+/**
+ * The selection of a terminal screen.
+ *
+ * The ends of the selection are kept in absolute line numbers, which count
+ * the lines from the beginning of the output rather than from the top of the
+ * history.  A line keeps its absolute number while it scrolls from the screen
+ * into the history and until it drops out of the history, so the selection
+ * does not need to be adjusted when the screen scrolls.  Only lines which are
+ * moved around within the screen, by scrolling a region which does not start
+ * at the top of the screen for example, need moveLines().
+ *
+ * Rather than testing cells one by one, users of the selection ask for the
+ * span of selected columns in each line with columns().
+ */
+class ScreenSelection {
+public:
+    /** Constructs an empty selection. */
+    ScreenSelection();
+
+    /** Clears the selection. */
+    void clear();
+
+    /** Returns true if a selection has been started. */
+    bool isValid() const { return _valid; }
+
+    /** Returns true if the selection is a rectangular block of columns. */
+    bool isBlockMode() const { return _blockMode; }
+
+    /**
+     * Starts a new selection which consists of the character at @p column
+     * in the absolute line @p line.
+     */
+    void setStart(qint64 line, int column, bool blockMode);
+
+    /**
+     * Extends the selection from the position where it was started to
+     * @p column in the absolute line @p line.
+     */
+    void setEnd(qint64 line, int column);
+
+    /** Returns the first line of the selection. */
+    qint64 topLine() const { return _topLine; }
+    /** Returns the column of the first selected character in topLine(). */
+    int topColumn() const { return _topColumn; }
+    /** Returns the last line of the selection. */
+    qint64 bottomLine() const { return _bottomLine; }
+    /** Returns the column of the last selected character in bottomLine(). */
+    int bottomColumn() const { return _bottomColumn; }
+
+    /**
+     * Finds the columns of @p line which are selected, where the line is
+     * @p columnCount columns wide.  Returns false if no part of the line is
+     * selected, otherwise the selected columns are @p first to @p last.
+     */
+    bool columns(qint64 line, int columnCount, int& first, int& last) const;
+
+    /** Returns true if the character at @p column in @p line is selected. */
+    bool contains(qint64 line, int column) const;
+
+    /**
+     * Returns true if the selection overlaps the characters from
+     * @p startColumn in @p startLine to @p endColumn in @p endLine, taking
+     * the lines in between as a whole.
+     */
+    bool intersects(qint64 startLine, int startColumn,
+                    qint64 endLine, int endColumn) const;
+
+    /**
+     * Moves the ends of the selection which lie in the lines @p first to
+     * @p last by @p delta lines, to follow the text in these lines when it
+     * is moved.  The selection is cleared if one of its ends lies in the
+     * lines which the moved text is going to cover.
+     */
+    void moveLines(qint64 first, qint64 last, int delta);
+
+private:
+    // updates the top and the bottom of the selection from its two ends
+    void normalize();
+
+    // the position where the selection was started and the one it was
+    // extended to
+    qint64 _beginLine;
+    int _beginColumn;
+    qint64 _endLine;
+    int _endColumn;
+
+    qint64 _topLine;
+    int _topColumn;
+    qint64 _bottomLine;
+    int _bottomColumn;
+
+    bool _blockMode;
+    bool _valid;
+};
@@ -33,9 +33,17 @@
 
 ScreenWindow::ScreenWindow(QObject* parent)
     : QObject(parent)
+    , _screen(0)
+    , _screenLock(0)
     , _windowBuffer(0)
     , _windowBufferSize(0)
     , _bufferNeedsUpdate(true)
+    , _bufferValid(false)
+    , _bufferStartLine(0)
+    , _bufferHistoryLines(0)
+    , _bufferColumns(0)
+    , _bufferCursorLine(-1)
+    , _bufferGeneration(0)
     , _windowLines(1)
     , _currentLine(0)
     , _trackOutput(true)
@@ -51,6 +59,13 @@ void ScreenWindow::setScreen(Screen* screen)
     Q_ASSERT( screen );
 
     _screen = screen;
+    _bufferValid = false;
+    _bufferNeedsUpdate = true;
+}
+
+void ScreenWindow::setScreenLock(QMutex* lock)
+{
+    _screenLock = lock;
 }
 
 Screen* ScreenWindow::screen() const
@@ -60,6 +75,8 @@ Screen* ScreenWindow::screen() const
 
 Character* ScreenWindow::getImage()
 {
+    QMutexLocker locker(_screenLock);
+
     // reallocate internal buffer if the window size has changed
     int size = windowLines() * windowColumns();
     if (_windowBuffer == 0 || _windowBufferSize != size)
@@ -68,23 +85,84 @@ Character* ScreenWindow::getImage()
         _windowBufferSize = size;
         _windowBuffer = new Character[size];
         _bufferNeedsUpdate = true;
+        _bufferValid = false;
     }
 
     if (!_bufferNeedsUpdate)
         return _windowBuffer;
 
-    _screen->getImage(_windowBuffer,size,
-                      currentLine(),endWindowLine());
-
-    // this window may look beyond the end of the screen, in which
-    // case there will be an unused area which needs to be filled
-    // with blank characters
-    fillUnusedArea();
+    updateBuffer();
 
     _bufferNeedsUpdate = false;
     return _windowBuffer;
 }
 
+void ScreenWindow::updateBuffer()
+{
+    const int startLine = currentLine();
+    const int endLine = endWindowLine();
+    const int columns = windowColumns();
+    const int historyLines = _screen->getHistLines();
+    const int cursorLine = historyLines + _screen->getCursorY();
+    const quint64 lastGeneration = _bufferGeneration;
+    _bufferGeneration = _screen->nextGeneration();
+
+    if (_changedLines.size() != windowLines())
+    {
+        _changedLines.fill(true,windowLines());
+        _bufferValid = false;
+    }
+
+    // copy the whole window if it has moved or if something has changed
+    // which affects all of it, such as the selection or the history
+    if (!_bufferValid ||
+        startLine != _bufferStartLine ||
+        historyLines != _bufferHistoryLines ||
+        columns != _bufferColumns ||
+        _screen->imageGeneration() > lastGeneration)
+    {
+        _screen->getImage(_windowBuffer,_windowBufferSize,startLine,endLine);
+
+        // this window may look beyond the end of the screen, in which
+        // case there will be an unused area which needs to be filled
+        // with blank characters
+        fillUnusedArea();
+
+        _changedLines.fill(true);
+    }
+    else
+    {
+        // otherwise only copy the screen lines which have changed, and the
+        // lines which the cursor has moved from and to
+        for (int line = qMax(startLine,historyLines); line <= endLine; line++)
+        {
+            if (line != cursorLine && line != _bufferCursorLine &&
+                _screen->lineGeneration(line - historyLines) <= lastGeneration)
+                continue;
+
+            const int windowLine = line - startLine;
+            _screen->getImage(_windowBuffer + windowLine*columns,columns,line,line);
+            _changedLines.setBit(windowLine);
+        }
+    }
+
+    _bufferValid = true;
+    _bufferStartLine = startLine;
+    _bufferHistoryLines = historyLines;
+    _bufferColumns = columns;
+    _bufferCursorLine = cursorLine;
+}
+
+QBitArray ScreenWindow::changedLines() const
+{
+    return _changedLines;
+}
+
+void ScreenWindow::resetChangedLines()
+{
+    _changedLines.fill(false);
+}
+
 void ScreenWindow::fillUnusedArea()
 {
     int screenEndLine = _screen->getHistLines() + _screen->getLines() - 1;
@@ -110,6 +188,8 @@ int ScreenWindow::endWindowLine() const
 }
 QVector<LineProperty> ScreenWindow::getLineProperties()
 {
+    QMutexLocker locker(_screenLock);
+
     QVector<LineProperty> result = _screen->getLineProperties(currentLine(),endWindowLine());
     
     if (result.count() != windowLines())
@@ -120,21 +200,29 @@ QVector<LineProperty> ScreenWindow::getLineProperties()
 
 QString ScreenWindow::selectedText( bool preserveLineBreaks ) const
 {
+    QMutexLocker locker(_screenLock);
+
     return _screen->selectedText( preserveLineBreaks );
 }
 
 void ScreenWindow::getSelectionStart( int& column , int& line )
 {
+    QMutexLocker locker(_screenLock);
+
     _screen->getSelectionStart(column,line);
     line -= currentLine();
 }
 void ScreenWindow::getSelectionEnd( int& column , int& line )
 {
+    QMutexLocker locker(_screenLock);
+
     _screen->getSelectionEnd(column,line);
     line -= currentLine();
 }
 void ScreenWindow::setSelectionStart( int column , int line , bool columnMode )
 {
+    QMutexLocker locker(_screenLock);
+
     _screen->setSelectionStart( column , qMin(line + currentLine(),endWindowLine())  , columnMode);
     
     _bufferNeedsUpdate = true;
@@ -143,6 +231,8 @@ void ScreenWindow::setSelectionStart( int column , int line , bool columnMode )
 
 void ScreenWindow::setSelectionEnd( int column , int line )
 {
+    QMutexLocker locker(_screenLock);
+
     _screen->setSelectionEnd( column , qMin(line + currentLine(),endWindowLine()) );
 
     _bufferNeedsUpdate = true;
@@ -151,11 +241,15 @@ void ScreenWindow::setSelectionEnd( int column , int line )
 
 bool ScreenWindow::isSelected( int column , int line )
 {
+    QMutexLocker locker(_screenLock);
+
     return _screen->isSelected( column , qMin(line + currentLine(),endWindowLine()) );
 }
 
 void ScreenWindow::clearSelection()
 {
+    QMutexLocker locker(_screenLock);
+
     _screen->clearSelection();
 
     emit selectionChanged();
@@ -173,21 +267,29 @@ int ScreenWindow::windowLines() const
 
 int ScreenWindow::windowColumns() const
 {
+    QMutexLocker locker(_screenLock);
+
     return _screen->getColumns();
 }
 
 int ScreenWindow::lineCount() const
 {
+    QMutexLocker locker(_screenLock);
+
     return _screen->getHistLines() + _screen->getLines();
 }
 
 int ScreenWindow::columnCount() const
 {
+    QMutexLocker locker(_screenLock);
+
     return _screen->getColumns();
 }
 
 QPoint ScreenWindow::cursorPosition() const
 {
+    QMutexLocker locker(_screenLock);
+
     QPoint position;
     
     position.setX( _screen->getCursorX() );
@@ -257,16 +359,20 @@ void ScreenWindow::resetScrollCount()
 
 QRect ScreenWindow::scrollRegion() const
 {
+    QMutexLocker locker(_screenLock);
+
     bool equalToScreenSize = windowLines() == _screen->getLines();
 
     if ( atEndOfOutput() && equalToScreenSize )
-        return _screen->lastScrolledRegion();
+        return _scrolledRegion;
     else
         return QRect(0,0,windowColumns(),windowLines());
 }
 
-void ScreenWindow::notifyOutputChanged()
+void ScreenWindow::updateFromScreen()
 {
+    QMutexLocker locker(_screenLock);
+
     // move window to the bottom of the screen and update scroll count
     // if this window is currently tracking the bottom of the screen
     if ( _trackOutput )
@@ -289,7 +395,22 @@ void ScreenWindow::notifyOutputChanged()
         _currentLine = qMin( _currentLine , _screen->getHistLines() );
     }
 
+    _scrolledRegion = _screen->lastScrolledRegion();
+
+    // copy the image now, so that the views which handle outputChanged()
+    // do not need to hold the lock while they compare it with their own
     _bufferNeedsUpdate = true;
+    getImage();
+}
+
+void ScreenWindow::notifyPainted(double msecs)
+{
+    emit painted(msecs);
+}
+
+void ScreenWindow::notifyOutputChanged()
+{
+    updateFromScreen();
 
     emit outputChanged();
 }
@@ -31,6 +31,8 @@
 class Screen;
 
 // Qt includes
+#include <QBitArray>
+#include <QMutex>
 #include <QObject>
 #include <QPoint>
 #include <QRect>
@@ -74,6 +76,17 @@ public:
     /** Returns the screen which this window looks onto */
     Screen* screen() const;
 
+    /**
+     * Sets the mutex which guards the screen against concurrent modification.
+     *
+     * When the emulation parses its input on a worker thread, every access
+     * to the screen from the window is made while holding this lock.  The
+     * window's image is copied out of the screen under the lock, so the view
+     * paints from its own buffer while the worker carries on modifying the
+     * screen.  A null lock (the default) disables locking.
+     */
+    void setScreenLock(QMutex* lock);
+
     /**
      * Returns the image of characters which are currently visible through this window
      * onto the screen.
@@ -83,6 +96,22 @@ public:
      */
     Character* getImage();
 
+    /**
+     * Returns the lines of the window whose contents have changed in calls to
+     * getImage() since the last call to resetChangedLines().  Bit @p n is set
+     * if line @p n of the window has changed.
+     *
+     * The window only copies the lines which have changed out of the screen,
+     * so views can use this to compare and redraw only those lines.  When
+     * the window is resized, all of its lines are reported as changed.
+     */
+    QBitArray changedLines() const;
+
+    /**
+     * Resets the lines returned by changedLines()
+     */
+    void resetChangedLines();
+
     /**
      * Returns the line attributes associated with the lines of characters which
      * are currently visible through this window
@@ -217,11 +246,25 @@ public:
      */
     QString selectedText( bool preserveLineBreaks ) const;
 
+    /**
+     * Moves the window to the bottom of the screen if trackOutput() is true and copies
+     * the screen's image into the window, without emitting outputChanged().
+     *
+     * The emulation calls this with the screen lock held, so that the views can
+     * take in the new image afterwards without blocking the emulation.
+     */
+    void updateFromScreen();
+
+    /**
+     * Called by a view after painting the contents of the window, which took
+     * @p msecs milliseconds.  Emits painted().
+     */
+    void notifyPainted(double msecs);
+
 public slots:
     /**
      * Notifies the window that the contents of the associated terminal screen have changed.
-     * This moves the window to the bottom of the screen if trackOutput() is true and causes
-     * the outputChanged() signal to be emitted.
+     * This calls updateFromScreen() and causes the outputChanged() signal to be emitted.
      */
     void notifyOutputChanged();
 
@@ -241,17 +284,36 @@ signals:
     /** Emitted when the selection is changed. */
     void selectionChanged();
 
+    /**
+     * Emitted when a view has painted the contents of the window.
+     *
+     * @param msecs The time painting took, in milliseconds.
+     */
+    void painted(double msecs);
+
 private:
     int endWindowLine() const;
     void fillUnusedArea();
+    void updateBuffer();
 
     Screen* _screen;
-    Character* _windowBuffer;
+    QMutex* _screenLock;
+    Character* _windowBuffer; // front buffer, copied from the screen by getImage()
     int _windowBufferSize;
     bool _bufferNeedsUpdate;
 
+    // what the window buffer was last copied from, see updateBuffer()
+    bool _bufferValid;
+    int _bufferStartLine;
+    int _bufferHistoryLines;
+    int _bufferColumns;
+    int _bufferCursorLine;
+    quint64 _bufferGeneration;
+    QBitArray _changedLines;
+
     int  _windowLines;
     int  _currentLine;
     bool _trackOutput;
     int  _scrollCount;
+    QRect _scrolledRegion; // screen's last scrolled region, see updateFromScreen()
 };
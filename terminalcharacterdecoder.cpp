@@ -103,7 +103,7 @@ void PlainTextDecoder::decodeLine(const Character* const characters, int count,
     
     for (int i=0;i<outputCount;)
     {
-        plainText.append( QChar(characters[i].character) );
+        appendCodePoint( plainText, characters[i].character );
         i += qMax(1,konsole_wcwidth(characters[i].character));
     }
     *_output << plainText;
@@ -112,6 +112,7 @@ void PlainTextDecoder::decodeLine(const Character* const characters, int count,
 HTMLDecoder::HTMLDecoder() :
     _output(0)
   ,_colorTable(base_color_table)
+  ,_rgbColorTable(0)
   ,_innerSpanOpen(false)
   ,_lastRendition(DEFAULT_RENDITION)
 {
@@ -156,7 +157,7 @@ void HTMLDecoder::decodeLine(const Character* const characters, int count, LineP
 
     for (int i=0;i<count;i++)
     {
-        QChar ch(characters[i].character);
+        uint ch = characters[i].character;
 
         //check if appearance of character is different from previous char
         if ( characters[i].rendition != _lastRendition  ||
@@ -189,11 +190,11 @@ void HTMLDecoder::decodeLine(const Character* const characters, int count, LineP
             //colours - a colour table must have been defined first
             if ( _colorTable )
             {
-                style.append( QString("color:%1;").arg(_lastForeColor.color(_colorTable).name() ) );
+                style.append( QString("color:%1;").arg(_lastForeColor.color(_colorTable,_rgbColorTable).name() ) );
 
                 if (!characters[i].isTransparent(_colorTable))
                 {
-                    style.append( QString("background-color:%1;").arg(_lastBackColor.color(_colorTable).name() ) );
+                    style.append( QString("background-color:%1;").arg(_lastBackColor.color(_colorTable,_rgbColorTable).name() ) );
                 }
             }
 
@@ -203,7 +204,7 @@ void HTMLDecoder::decodeLine(const Character* const characters, int count, LineP
         }
 
         //handle whitespace
-        if (ch.isSpace())
+        if (QChar::isSpace(ch))
             spaceCount++;
         else
             spaceCount = 0;
@@ -218,7 +219,7 @@ void HTMLDecoder::decodeLine(const Character* const characters, int count, LineP
             else if (ch == '>')
                 text.append("&gt;");
             else
-                text.append(ch);
+                appendCodePoint(text, ch);
         }
         else
         {
@@ -250,3 +251,8 @@ void HTMLDecoder::setColorTable(const ColorEntry* table)
 {
     _colorTable = table;
 }
+
+void HTMLDecoder::setRgbColorTable(const RgbColorTable* table)
+{
+    _rgbColorTable = table;
+}
@@ -129,6 +129,12 @@ public:
      */
     void setColorTable( const ColorEntry* table );
 
+    /**
+     * Sets the table which the RGB colors of the characters are looked up in,
+     * see Screen::rgbColorTable()
+     */
+    void setRgbColorTable( const RgbColorTable* table );
+
     virtual void decodeLine(const Character* const characters,
                             int count,
                             LineProperty properties);
@@ -142,6 +148,7 @@ private:
 
     QTextStream* _output;
     const ColorEntry* _colorTable;
+    const RgbColorTable* _rgbColorTable;
     bool _innerSpanOpen;
     quint8 _lastRendition;
     CharacterColor _lastForeColor;
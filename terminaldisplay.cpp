@@ -31,6 +31,7 @@
 #include "terminaldisplay.h"
 #include "filter.h"
 #include "konsole_wcwidth.h"
+#include "screen.h"
 #include "screenwindow.h"
 #include "terminalcharacterdecoder.h"
 
@@ -55,6 +56,7 @@
 #include <QUrl>
 #include <QMimeData>
 #include <QDrag>
+#include <QElapsedTimer>
 
 
 // WARNING: Autogenerated by "fontembedder ./linefont.src".
@@ -146,6 +148,7 @@ void TerminalDisplay::setScreenWindow(ScreenWindow* window)
     }
 
     _screenWindow = window;
+    _imageNeedsFullUpdate = true;
 
     if ( window )
     {
@@ -208,7 +211,19 @@ void TerminalDisplay::setColorTable(const ColorEntry table[])
    QCodec.
 */
 
-static inline bool isLineChar(quint16 c) { return ((c & 0xFF80) == 0x2500);}
+static inline bool isLineChar(uint c) { return ((c & ~0x7Fu) == 0x2500);}
+
+// stores the code point c at position p of a QChar buffer, using two
+// entries if c lies outside the basic multilingual plane
+static inline void storeCodePoint(QChar* buffer, int& p, uint c)
+{
+    if (QChar::requiresSurrogates(c)) {
+        buffer[p++] = QChar(QChar::highSurrogate(c));
+        buffer[p++] = QChar(QChar::lowSurrogate(c));
+    } else {
+        buffer[p++] = QChar(c);
+    }
+}
 static inline bool isLineCharString(QString string)
 {
     return (string.length() > 0) && (isLineChar(string.at(0).unicode()));
@@ -297,7 +312,14 @@ int TerminalDisplay::textWidth(int startColumn, int length, int line) const {
     QFontMetrics fm(font());
     int result = 0;
     for (int column = 0; column < length; column++) {
-        result += fm.width(_image[loc(startColumn + column, line)].character);
+        uint c = _image[loc(startColumn + column, line)].character;
+        if (QChar::requiresSurrogates(c)) {
+            QString s;
+            appendCodePoint(s, c);
+            result += fm.width(s);
+        } else {
+            result += fm.width(QChar(c));
+        }
     }
     return result;
 }
@@ -339,6 +361,9 @@ TerminalDisplay::TerminalDisplay(QWidget *parent)
     ,_contentHeight(1)
     ,_contentWidth(1)
     ,_image(0)
+    ,_imageNeedsFullUpdate(true)
+    ,_rgbColors(0)
+    ,_rgbColorsGeneration(0)
     ,_randomSeed(0)
     ,_resizing(false)
     ,_terminalSizeHint(false)
@@ -738,7 +763,7 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
 
     // setup pen
     const CharacterColor& textColor = ( invertCharacterColor ? style->backgroundColor : style->foregroundColor );
-    const QColor color = textColor.color(_colorTable);
+    const QColor color = textColor.color(_colorTable,_rgbColors);
     QPen pen = painter.pen();
     if ( pen.color() != color )
     {
@@ -776,8 +801,8 @@ void TerminalDisplay::drawTextFragment(QPainter& painter ,
     painter.save();
 
     // setup painter
-    const QColor foregroundColor = style->foregroundColor.color(_colorTable);
-    const QColor backgroundColor = style->backgroundColor.color(_colorTable);
+    const QColor foregroundColor = style->foregroundColor.color(_colorTable,_rgbColors);
+    const QColor backgroundColor = style->backgroundColor.color(_colorTable,_rgbColors);
     
     // draw background if different from the display's background color
     if ( backgroundColor != palette().background().color() )
@@ -988,7 +1013,11 @@ void TerminalDisplay::updateImage()
 
     // optimization - scroll the existing image where possible and
     // avoid expensive text drawing for parts of the image that
-    // can simply be moved up or down
+    // can simply be moved up or down.  The lines of _image no longer
+    // correspond to the window's lines afterwards, so all of them need
+    // to be compared.
+    if ( _screenWindow->scrollCount() != 0 )
+        _imageNeedsFullUpdate = true;
     scrollImage( _screenWindow->scrollCount() ,
                  _screenWindow->scrollRegion() );
     _screenWindow->resetScrollCount();
@@ -1003,6 +1032,21 @@ void TerminalDisplay::updateImage()
     int lines = _screenWindow->windowLines();
     int columns = _screenWindow->windowColumns();
 
+    // the RGB colors of the characters which are not redrawn below are
+    // looked up again when they are painted, which is only right if none
+    // of them has been reclaimed since they were copied
+    const RgbColorTable* rgbColors = _screenWindow->screen()->rgbColorTable();
+    if (rgbColors != _rgbColors || rgbColors->generation() != _rgbColorsGeneration)
+    {
+        _rgbColors = rgbColors;
+        _rgbColorsGeneration = rgbColors->generation();
+        update();
+    }
+
+    // only the lines which the window has copied afresh can differ from _image
+    const QBitArray changedLines = _screenWindow->changedLines();
+    _screenWindow->resetChangedLines();
+
     setScroll( _screenWindow->currentLine() , _screenWindow->lineCount() );
 
     Q_ASSERT( this->_usedLines <= this->_lines );
@@ -1013,7 +1057,6 @@ void TerminalDisplay::updateImage()
     QPoint tL  = contentsRect().topLeft();
     int    tLx = tL.x();
     int    tLy = tL.y();
-    _hasBlinker = false;
 
     CharacterColor cf;       // undefined
     CharacterColor _clipboard;       // undefined
@@ -1022,7 +1065,13 @@ void TerminalDisplay::updateImage()
     const int linesToUpdate = qMin(this->_lines, qMax(0,lines  ));
     const int columnsToUpdate = qMin(this->_columns,qMax(0,columns));
 
-    QChar *disstrU = new QChar[columnsToUpdate];
+    const bool fullUpdate = _imageNeedsFullUpdate || changedLines.size() < linesToUpdate;
+    _imageNeedsFullUpdate = false;
+    if (fullUpdate || _blinkingLines.size() != linesToUpdate)
+        _blinkingLines.fill(false,linesToUpdate);
+
+    // room for a surrogate pair in every column
+    QChar *disstrU = new QChar[2*columnsToUpdate];
     char *dirtyMask = new char[columnsToUpdate+2];
     QRegion dirtyRegion;
 
@@ -1033,10 +1082,14 @@ void TerminalDisplay::updateImage()
 
     for (y = 0; y < linesToUpdate; ++y)
     {
+        if (!fullUpdate && !changedLines.testBit(y))
+            continue;
+
         const Character*       currentLine = &_image[y*this->_columns];
         const Character* const newLine = &newimg[y*columns];
 
         bool updateLine = false;
+        bool lineHasBlinker = false;
 
         // The dirty mask indicates which characters need repainting. We also
         // mark surrounding neighbours dirty, in case the character exceeds
@@ -1054,18 +1107,18 @@ void TerminalDisplay::updateImage()
         if (!_resizing) // not while _resizing, we're expecting a paintEvent
             for (x = 0; x < columnsToUpdate; ++x)
             {
-                _hasBlinker |= (newLine[x].rendition & RE_BLINK);
+                lineHasBlinker |= (newLine[x].rendition & RE_BLINK);
 
                 // Start drawing if this character or the next one differs.
                 // We also take the next one into account to handle the situation
                 // where characters exceed their cell width.
                 if (dirtyMask[x])
                 {
-                    quint16 c = newLine[x+0].character;
+                    uint c = newLine[x+0].character;
                     if ( !c )
                         continue;
                     int p = 0;
-                    disstrU[p++] = c; //fontMap(c);
+                    storeCodePoint(disstrU, p, c); //fontMap(c);
                     bool lineDraw = isLineChar(c);
                     bool doubleWidth = (x+1 == columnsToUpdate) ? false : (newLine[x+1].character == 0);
                     cr = newLine[x].rendition;
@@ -1089,7 +1142,7 @@ void TerminalDisplay::updateImage()
                               nextIsDoubleWidth != doubleWidth )
                             break;
 
-                        disstrU[p++] = c; //fontMap(c);
+                        storeCodePoint(disstrU, p, c); //fontMap(c);
                     }
 
                     QString unistr(disstrU, p);
@@ -1131,11 +1184,15 @@ void TerminalDisplay::updateImage()
             dirtyRegion |= dirtyRect;
         }
 
+        _blinkingLines.setBit(y,lineHasBlinker);
+
         // replace the line of characters in the old _image with the
         // current line of the new _image
         memcpy((void*)currentLine,(const void*)newLine,columnsToUpdate*sizeof(Character));
     }
 
+    _hasBlinker = _blinkingLines.count(true) > 0;
+
     // if the new _image is smaller than the previous _image, then ensure that the area
     // outside the new _image is cleared
     if ( linesToUpdate < _usedLines )
@@ -1259,6 +1316,9 @@ void TerminalDisplay::focusInEvent(QFocusEvent*)
 
 void TerminalDisplay::paintEvent( QPaintEvent* pe )
 {
+    QElapsedTimer paintClock;
+    paintClock.start();
+
     QPainter paint(this);
 
     foreach (const QRect &rect, (pe->region() & contentsRect()).rects())
@@ -1269,6 +1329,10 @@ void TerminalDisplay::paintEvent( QPaintEvent* pe )
     }
     drawInputMethodPreeditString(paint,preeditRect());
     paintFilters(paint);
+
+    // the emulation paces its updates by the time the views take to paint
+    if (_screenWindow)
+        _screenWindow->notifyPainted(paintClock.nsecsElapsed() / 1000000.0);
 }
 
 QPoint TerminalDisplay::cursorPosition() const
@@ -1328,7 +1392,7 @@ void TerminalDisplay::paintFilters(QPainter& painter)
     getCharacterPosition( cursorPos , cursorLine , cursorColumn );
     Character cursorCharacter = _image[loc(cursorColumn,cursorLine)];
 
-    painter.setPen( QPen(cursorCharacter.foregroundColor.color(colorTable())) );
+    painter.setPen( QPen(cursorCharacter.foregroundColor.color(colorTable(),_rgbColors)) );
 
     // iterate over hotspots identified by the display's currently active filters
     // and draw appropriate visuals to indicate the presence of the hotspot
@@ -1377,7 +1441,7 @@ void TerminalDisplay::paintFilters(QPainter& painter)
             // display in _columns
 
             // ignore whitespace at the end of the lines
-            while ( QChar(_image[loc(endColumn,line)].character).isSpace() && endColumn > 0 )
+            while ( QChar::isSpace(_image[loc(endColumn,line)].character) && endColumn > 0 )
                 endColumn--;
 
             // increment here because the column which we want to set 'endColumn' to
@@ -1439,12 +1503,13 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
     int rlx = qMin(_usedColumns-1, qMax(0,(rect.right()  - tLx - _leftMargin ) / _fontWidth));
     int rly = qMin(_usedLines-1,   qMax(0,(rect.bottom() - tLy - _topMargin  ) / _fontHeight));
 
-    const int bufferSize = _usedColumns;
+    // room for a surrogate pair in every column
+    const int bufferSize = 2*_usedColumns;
     QString unistr;
     unistr.reserve(bufferSize);
     for (int y = luy; y <= rly; y++)
     {
-        quint16 c = _image[loc(lux,y)].character;
+        uint c = _image[loc(lux,y)].character;
         int x = lux;
         if(!c && x)
             x--; // Search for start of multi-column character
@@ -1462,12 +1527,12 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
             {
                 // sequence of characters
                 ushort extendedCharLength = 0;
-                ushort* chars = ExtendedCharTable::instance
-                        .lookupExtendedChar(_image[loc(x,y)].charSequence,extendedCharLength);
+                uint* chars = ExtendedCharTable::instance
+                        .lookupExtendedChar(_image[loc(x,y)].character,extendedCharLength);
                 for ( int index = 0 ; index < extendedCharLength ; index++ )
                 {
-                    Q_ASSERT( p < bufferSize );
-                    disstrU[p++] = chars[index];
+                    Q_ASSERT( p+1 < bufferSize );
+                    storeCodePoint(disstrU, p, chars[index]);
                 }
             }
             else
@@ -1476,8 +1541,8 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
                 c = _image[loc(x,y)].character;
                 if (c)
                 {
-                    Q_ASSERT( p < bufferSize );
-                    disstrU[p++] = c; //fontMap(c);
+                    Q_ASSERT( p+1 < bufferSize );
+                    storeCodePoint(disstrU, p, c); //fontMap(c);
                 }
             }
 
@@ -1495,7 +1560,7 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
                    isLineChar( c = _image[loc(x+len,y)].character) == lineDraw) // Assignment!
             {
                 if (c)
-                    disstrU[p++] = c; //fontMap(c);
+                    storeCodePoint(disstrU, p, c); //fontMap(c);
                 if (doubleWidth) // assert((_image[loc(x+len,y)+1].character == 0)), see above if condition
                     len++; // Skip trailing part of multi-column character
                 len++;
@@ -2010,7 +2075,7 @@ void TerminalDisplay::extendSelection( const QPoint& position )
     {
         // Extend to word boundaries
         int i;
-        QChar selClass;
+        uint selClass;
 
         bool left_not_right = ( here.y() < _iPntSelCorr.y() ||
                                 ( here.y() == _iPntSelCorr.y() && here.x() < _iPntSelCorr.x() ) );
@@ -2087,7 +2152,7 @@ void TerminalDisplay::extendSelection( const QPoint& position )
     if ( !_wordSelectionMode && !_lineSelectionMode )
     {
         int i;
-        QChar selClass;
+        uint selClass;
 
         bool left_not_right = ( here.y() < _iPntSelCorr.y() ||
                                 ( here.y() == _iPntSelCorr.y() && here.x() < _iPntSelCorr.x() ) );
@@ -2292,7 +2357,7 @@ void TerminalDisplay::mouseDoubleClickEvent(QMouseEvent* ev)
     _wordSelectionMode = true;
 
     // find word boundaries...
-    QChar selClass = charClass(_image[i].character);
+    uint selClass = charClass(_image[i].character);
     {
         // find the start of the word
         int x = bgnSel.x();
@@ -2331,7 +2396,7 @@ void TerminalDisplay::mouseDoubleClickEvent(QMouseEvent* ev)
         endSel.setX(x);
 
         // In word selection mode don't select @ (64) if at end of word.
-        if ( ( QChar( _image[i].character ) == '@' ) && ( ( endSel.x() - bgnSel.x() ) > 0 ) )
+        if ( ( _image[i].character == '@' ) && ( ( endSel.x() - bgnSel.x() ) > 0 ) )
             endSel.setX( x - 1 );
 
 
@@ -2425,7 +2490,7 @@ void TerminalDisplay::mouseTripleClickEvent(QMouseEvent* ev)
     if (_tripleClickMode == SelectForwardsFromCursor) {
         // find word boundary start
         int i = loc(_iPntSel.x(),_iPntSel.y());
-        QChar selClass = charClass(_image[i].character);
+        uint selClass = charClass(_image[i].character);
         int x = _iPntSel.x();
 
         while ( ((x>0) ||
@@ -2471,14 +2536,19 @@ bool TerminalDisplay::focusNextPrevChild( bool next )
 }
 
 
-QChar TerminalDisplay::charClass(QChar qch) const
+uint TerminalDisplay::charClass(uint ch) const
 {
-    if ( qch.isSpace() ) return ' ';
+    if ( QChar::isSpace(ch) ) return ' ';
 
-    if ( qch.isLetterOrNumber() || _wordCharacters.contains(qch, Qt::CaseInsensitive ) )
+    if ( QChar::isLetterOrNumber(ch) )
         return 'a';
 
-    return qch;
+    QString character;
+    appendCodePoint(character, ch);
+    if ( _wordCharacters.contains(character, Qt::CaseInsensitive ) )
+        return 'a';
+
+    return ch;
 }
 
 void TerminalDisplay::setWordCharacters(QString wc)
@@ -2834,6 +2904,8 @@ void TerminalDisplay::swapColorTable()
 
 void TerminalDisplay::clearImage()
 {
+    _imageNeedsFullUpdate = true;
+
     // We initialize _image[_imageSize] too. See makeImage()
     for (int i = 0; i <= _imageSize; i++)
     {
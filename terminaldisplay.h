@@ -33,6 +33,7 @@
 class ScreenWindow;
 
 // Qt
+#include <QBitArray>
 #include <QColor>
 #include <QPointer>
 #include <QWidget>
@@ -613,7 +614,7 @@ protected:
     //     - A space (returns ' ')
     //     - Part of a word (returns 'a')
     //     - Other characters (returns the input character)
-    QChar charClass(QChar ch) const;
+    uint charClass(uint ch) const;
 
     void clearImage();
 
@@ -742,8 +743,16 @@ private:
     // only the area [usedLines][usedColumns] in the image contains valid data
 
     int _imageSize;
+    // set when _image no longer matches what the screen window last handed
+    // out, so that updateImage() has to compare every line
+    bool _imageNeedsFullUpdate;
     QVector<LineProperty> _lineProperties;
 
+    // the table which the RGB colors in _image are looked up in, and its
+    // generation when they were copied, see RgbColorTable::generation()
+    const RgbColorTable* _rgbColors;
+    int _rgbColorsGeneration;
+
     ColorEntry _colorTable[TABLE_COLORS];
     uint _randomSeed;
 
@@ -770,6 +779,7 @@ private:
 
     bool _blinking;   // hide text in paintEvent
     bool _hasBlinker; // has characters to blink
+    QBitArray _blinkingLines; // lines of _image with characters to blink
     bool _cursorBlinking;     // hide cursor in paintEvent
     bool _hasBlinkingCursor;  // has blinking cursor enabled
     bool _allowBlinkingText;  // allow text to blink
@@ -42,28 +42,64 @@
 // Qt includes
 #include <QApplication>
 #include <QClipboard>
+#include <QElapsedTimer>
 #include <QHash>
 #include <QKeyEvent>
+#include <QMetaObject>
 #include <QRegExp>
 #include <QTextStream>
 #include <QThread>
 #include <QTime>
 
+#define BULK_TIMEOUT1 10
+#define BULK_TIMEOUT2 40
+// upper bound for the frame interval while the terminal is flooded
+#define MAX_BULK_TIMEOUT 200
+// the views may spend up to a quarter of the time updating
+#define RENDER_BUDGET 4
+// above this rate of input (bytes per second) the terminal counts as flooded
+#define FLOOD_RATE (256 * 1024)
+#define COALESCING_INTERVAL 4
+// share of the time between two frames spent on the terminal, and number of
+// frames in a row, after which reading the input is briefly stopped
+#define OVERLOAD_LOAD 0.9
+#define OVERLOAD_FRAMES 3
+
 TerminalEmulation::TerminalEmulation() :
     _currentScreen(0),
     _codec(0),
     _decoder(0),
     _keyTranslator(0),
-    _usesMouse(false)
+    _screenMutex(QMutex::Recursive),
+    _usesMouse(false),
+    _updatePending(0),
+    _inputBytes(0),
+    _parseTime(0),
+    _paintTime(0),
+    _inputRate(0),
+    _renderCost(0),
+    _frameInterval(BULK_TIMEOUT2),
+    _coalescingInterval(0),
+    _overloadedFrames(0),
+    _inputSuspended(false)
 {
     // create screens with a default size
     _screen[0] = new Screen(40,80);
     _screen[1] = new Screen(40,80);
+    // only the primary screen is reflowed, applications using the alternate
+    // screen redraw it themselves after a resize
+    _screen[0]->setReflowLines(true);
     _currentScreen = _screen[0];
 
+    _zmodemTrigger = _triggerSequenceScanner.addSequence("\030B00");
+
     QObject::connect(&_bulkTimer1, SIGNAL(timeout()), this, SLOT(showBulk()) );
     QObject::connect(&_bulkTimer2, SIGNAL(timeout()), this, SLOT(showBulk()) );
 
+    _resumeInputTimer.setSingleShot(true);
+    QObject::connect(&_resumeInputTimer, SIGNAL(timeout()), this, SLOT(resumeInput()) );
+    _frameClock.start();
+
     // listen for mouse status changes
     connect( this , SIGNAL(programUsesMouseChanged(bool)) ,
              SLOT(usesMouseChanged(bool)) );
@@ -79,17 +115,28 @@ void TerminalEmulation::usesMouseChanged(bool usesMouse)
     _usesMouse = usesMouse;
 }
 
+QMutex* TerminalEmulation::screenLock() const
+{
+    return &_screenMutex;
+}
+
 ScreenWindow* TerminalEmulation::createWindow()
 {
+    QMutexLocker locker(&_screenMutex);
+
     ScreenWindow* window = new ScreenWindow();
     window->setScreen(_currentScreen);
+    window->setScreenLock(&_screenMutex);
     _windows << window;
 
     connect(window , SIGNAL(selectionChanged()),
             this , SLOT(bufferedUpdate()));
+    connect(window , SIGNAL(painted(double)),
+            this , SLOT(addPaintTime(double)));
 
+    // showBulk() updates the windows itself before emitting outputChanged()
     connect(this , SIGNAL(outputChanged()),
-            window , SLOT(notifyOutputChanged()) );
+            window , SIGNAL(outputChanged()) );
     return window;
 }
 
@@ -109,6 +156,8 @@ TerminalEmulation::~TerminalEmulation()
 
 void TerminalEmulation::setScreen(int n)
 {
+    QMutexLocker locker(&_screenMutex);
+
     Screen *old = _currentScreen;
     _currentScreen = _screen[n & 1];
     if (_currentScreen != old)
@@ -121,10 +170,14 @@ void TerminalEmulation::setScreen(int n)
 
 void TerminalEmulation::clearHistory()
 {
+    QMutexLocker locker(&_screenMutex);
+
     _screen[0]->setScroll( _screen[0]->getScroll() , false );
 }
 void TerminalEmulation::setHistory(const HistoryType& t)
 {
+    QMutexLocker locker(&_screenMutex);
+
     _screen[0]->setScroll(t);
 
     showBulk();
@@ -137,13 +190,21 @@ const HistoryType& TerminalEmulation::history() const
 
 void TerminalEmulation::setCodec(const QTextCodec * qtc)
 {
-    if (qtc)
-        _codec = qtc;
-    else
-        setCodec(LocaleCodec);
+    {
+        // receiveData() uses the decoders in the emulation thread; the
+        // mutex is recursive, so escape sequences which switch the codec
+        // from inside the parser can still get here
+        QMutexLocker locker(&_screenMutex);
 
-    delete _decoder;
-    _decoder = _codec->makeDecoder();
+        if (qtc)
+            _codec = qtc;
+        else
+            _codec = QTextCodec::codecForLocale();
+
+        delete _decoder;
+        _decoder = _codec->makeDecoder();
+        _utf8Decoder.reset();
+    }
 
     emit useUtf8Request(utf8());
 }
@@ -187,6 +248,18 @@ void TerminalEmulation::receiveChar(int c)
     };
 }
 
+void TerminalEmulation::receivePrintableRun(const char* text, int length)
+{
+    for (int i = 0; i < length; i++)
+        receiveChar(text[i]);
+}
+
+void TerminalEmulation::receivePrintableCodePoints(const uint* codePoints, int length)
+{
+    for (int i = 0; i < length; i++)
+        receiveChar(codePoints[i]);
+}
+
 void TerminalEmulation::sendKeyEvent( QKeyEvent* ev )
 {
     emit stateSet(NOTIFYNORMAL);
@@ -209,6 +282,11 @@ void TerminalEmulation::sendMouseEvent(int /*buttons*/, int /*column*/, int /*ro
     // default implementation does nothing
 }
 
+void TerminalEmulation::sendQueuedData(QByteArray data)
+{
+    emit sendData(data.constData(), data.size());
+}
+
 /*
    We are doing code conversion from locale to unicode first.
 TODO: Character composition from the old code.  See #96536
@@ -216,27 +294,119 @@ TODO: Character composition from the old code.  See #96536
 
 void TerminalEmulation::receiveData(const char* text, int length)
 {
+    QMutexLocker locker(&_screenMutex);
+
+    QElapsedTimer parseClock;
+    parseClock.start();
+
     emit stateSet(NOTIFYACTIVITY);
 
     bufferedUpdate();
 
-    QString unicodeText = _decoder->toUnicode(text,length);
+    if (utf8())
+    {
+        receiveUtf8Data(text,length);
+    }
+    else
+    {
+        QString unicodeText = _decoder->toUnicode(text,length);
 
-    //send characters to terminal emulator
-    for (int i=0;i<unicodeText.length();i++)
-        receiveChar(unicodeText[i].unicode());
+        //send characters to terminal emulator, joining surrogate pairs
+        for (int i=0;i<unicodeText.length();i++)
+        {
+            uint c = unicodeText[i].unicode();
+            if (QChar::isHighSurrogate(c) && i+1 < unicodeText.length() &&
+                unicodeText[i+1].isLowSurrogate())
+                c = QChar::surrogateToUcs4(c, unicodeText[++i].unicode());
+            receiveChar(c);
+        }
+    }
 
-    //look for z-modem indicator
-    //-- someone who understands more about z-modems that I do may be able to move
-    //this check into the above for loop?
-    for (int i=0;i<length;i++)
+    // look for z-modem indicator and other trigger sequences
+    QVector<int> triggers = _triggerSequenceScanner.scan(text,length);
+    foreach (int id, triggers)
     {
-        if (text[i] == '\030')
+        if (id == _zmodemTrigger)
+            emit zmodemDetected();
+        else
+            emit triggerSequenceDetected(id);
+    }
+
+    _inputBytes.fetchAndAddRelaxed(length);
+    _parseTime.fetchAndAddRelaxed(parseClock.nsecsElapsed() / 1000);
+}
+
+int TerminalEmulation::addTriggerSequence(const QByteArray& sequence)
+{
+    QMutexLocker locker(&_screenMutex);
+    return _triggerSequenceScanner.addSequence(sequence);
+}
+
+void TerminalEmulation::removeTriggerSequence(int id)
+{
+    if (id == _zmodemTrigger)
+        return;
+
+    QMutexLocker locker(&_screenMutex);
+    _triggerSequenceScanner.removeSequence(id);
+}
+
+void TerminalEmulation::receiveUtf8Data(const char* text, int length)
+{
+    const char* end = text + length;
+    uint codePoints[2];
+
+    // decoded characters which need no parsing are collected and
+    // handed over together, like printable ASCII
+    uint run[256];
+    int runLength = 0;
+
+    while (text < end)
+    {
+        // printable ASCII needs no decoding, so hand it over in one piece
+        if (!_utf8Decoder.hasPendingSequence())
         {
-            if ((length-i-1 > 3) && (strncmp(text+i+1, "B00", 3) == 0))
-                emit zmodemDetected();
+            int asciiLength = Utf8Decoder::printableAsciiLength(text, end - text);
+            if (asciiLength > 0)
+            {
+                if (runLength > 0)
+                {
+                    receivePrintableCodePoints(run, runLength);
+                    runLength = 0;
+                }
+                receivePrintableRun(text, asciiLength);
+                text += asciiLength;
+                continue;
+            }
+        }
+
+        int count = _utf8Decoder.decode(*text++, codePoints);
+        for (int i = 0; i < count; i++)
+        {
+            // everything below U+00A0 is either ASCII or a C1 control
+            const bool printable = codePoints[i] >= 0xA0;
+            if (runLength > 0 && (!printable || runLength == 256))
+            {
+                receivePrintableCodePoints(run, runLength);
+                runLength = 0;
+            }
+
+            if (printable)
+                run[runLength++] = codePoints[i];
+            else
+                receiveCodePoint(codePoints[i]);
         }
     }
+
+    if (runLength > 0)
+        receivePrintableCodePoints(run, runLength);
+}
+
+void TerminalEmulation::receiveCodePoint(uint codePoint)
+{
+    // the emulation works on whole code points, including those beyond
+    // the basic multilingual plane
+    receiveChar(codePoint);
 }
 
 //OLDER VERSION
@@ -292,37 +462,135 @@ void TerminalEmulation::writeToStream( TerminalCharacterDecoder* _decoder ,
                                int startLine ,
                                int endLine)
 {
+    QMutexLocker locker(&_screenMutex);
+
     _currentScreen->writeLinesToStream(_decoder,startLine,endLine);
 }
 
 int TerminalEmulation::lineCount() const
 {
+    QMutexLocker locker(&_screenMutex);
+
     // sum number of lines currently on _screen plus number of lines in history
     return _currentScreen->getLines() + _currentScreen->getHistLines();
 }
 
-#define BULK_TIMEOUT1 10
-#define BULK_TIMEOUT2 40
-
 void TerminalEmulation::showBulk()
 {
     _bulkTimer1.stop();
     _bulkTimer2.stop();
 
+    QElapsedTimer renderClock;
+    renderClock.start();
+
+    {
+        // only copying the image into the windows needs the parser to wait,
+        // the views compare and paint the copies after the lock is released
+        QMutexLocker locker(&_screenMutex);
+
+        foreach(ScreenWindow* window,_windows)
+            window->updateFromScreen();
+
+        _currentScreen->resetScrolledLines();
+        _currentScreen->resetDroppedLines();
+    }
+
     emit outputChanged();
 
-    _currentScreen->resetScrolledLines();
-    _currentScreen->resetDroppedLines();
+    updateSchedule(renderClock.nsecsElapsed() / 1000000.0);
+}
+
+/*
+   Adapts the update scheduling to the load once per frame.
+
+   While output arrives continuously, receiveData() keeps restarting the
+   short timer and frames are paced by the long one, whose interval is raised
+   when the views are slow to update.  The views only schedule a repaint
+   while handling outputChanged(), so the render cost of a frame is the time
+   outputChanged() took plus the time the views spent painting since the
+   previous frame, ie. mostly painting the previous image.  A flood of output
+   additionally asks for small reads to be coalesced, and if the terminal
+   still takes up practically all of the event loop's time for several
+   frames, reading is suspended for one frame interval.
+*/
+void TerminalEmulation::updateSchedule(double updateTime)
+{
+    const double renderTime = updateTime + _paintTime;
+    _paintTime = 0;
+
+    qint64 elapsed = qMax(Q_INT64_C(1), _frameClock.restart());
+    int bytes = _inputBytes.fetchAndStoreRelaxed(0);
+    int parseTime = _parseTime.fetchAndStoreRelaxed(0);
+
+    // exponentially weighted moving averages
+    _inputRate = 0.75 * _inputRate + 0.25 * (bytes * 1000.0 / elapsed);
+    _renderCost = 0.75 * _renderCost + 0.25 * renderTime;
+
+    _frameInterval = qBound(BULK_TIMEOUT2, int(_renderCost * RENDER_BUDGET), MAX_BULK_TIMEOUT);
+
+    int coalescingInterval = _inputRate > FLOOD_RATE ? COALESCING_INTERVAL : 0;
+    if (coalescingInterval != _coalescingInterval)
+    {
+        _coalescingInterval = coalescingInterval;
+        emit inputCoalescingRequest(coalescingInterval);
+    }
+
+    double load = (parseTime / 1000.0 + renderTime) / elapsed;
+    _overloadedFrames = (load > OVERLOAD_LOAD) ? _overloadedFrames + 1 : 0;
+    if (_overloadedFrames >= OVERLOAD_FRAMES && !_inputSuspended)
+    {
+        _overloadedFrames = 0;
+        _inputSuspended = true;
+        emit inputSuspendRequest(true);
+        _resumeInputTimer.start(_frameInterval);
+    }
+}
+
+void TerminalEmulation::addPaintTime(double msecs)
+{
+    _paintTime += msecs;
+}
+
+void TerminalEmulation::resumeInput()
+{
+    _inputSuspended = false;
+    emit inputSuspendRequest(false);
+}
+
+int TerminalEmulation::frameInterval() const
+{
+    return _frameInterval;
+}
+
+double TerminalEmulation::inputRate() const
+{
+    return _inputRate;
+}
+
+double TerminalEmulation::renderCost() const
+{
+    return _renderCost;
 }
 
 void TerminalEmulation::bufferedUpdate()
 {
+    // the timers live in the emulation's thread, so when the input is parsed
+    // on a worker thread the update is scheduled from there instead.  Only
+    // one request is kept in the event queue at a time.
+    if (QThread::currentThread() != thread())
+    {
+        if (_updatePending.testAndSetOrdered(0, 1))
+            QMetaObject::invokeMethod(this, "bufferedUpdate", Qt::QueuedConnection);
+        return;
+    }
+    _updatePending.store(0);
+
     _bulkTimer1.setSingleShot(true);
     _bulkTimer1.start(BULK_TIMEOUT1);
     if (!_bulkTimer2.isActive())
     {
         _bulkTimer2.setSingleShot(true);
-        _bulkTimer2.start(BULK_TIMEOUT2);
+        _bulkTimer2.start(_frameInterval);
     }
 }
 
@@ -336,6 +604,8 @@ void TerminalEmulation::setImageSize(int lines, int columns)
     if ((lines < 1) || (columns < 1))
         return;
 
+    QMutexLocker locker(&_screenMutex);
+
     QSize screenSize[2] = { QSize(_screen[0]->getColumns(),
                             _screen[0]->getLines()),
                             QSize(_screen[1]->getColumns(),
@@ -355,10 +625,12 @@ void TerminalEmulation::setImageSize(int lines, int columns)
 
 QSize TerminalEmulation::imageSize() const
 {
+    QMutexLocker locker(&_screenMutex);
+
     return QSize(_currentScreen->getColumns(), _currentScreen->getLines());
 }
 
-ushort ExtendedCharTable::extendedCharHash(ushort* unicodePoints , ushort length) const
+ushort ExtendedCharTable::extendedCharHash(uint* unicodePoints , ushort length) const
 {
     ushort hash = 0;
     for ( ushort i = 0 ; i < length ; i++ )
@@ -367,11 +639,11 @@ ushort ExtendedCharTable::extendedCharHash(ushort* unicodePoints , ushort length
     }
     return hash;
 }
-bool ExtendedCharTable::extendedCharMatch(ushort hash , ushort* unicodePoints , ushort length) const
+bool ExtendedCharTable::extendedCharMatch(ushort hash , uint* unicodePoints , ushort length) const
 {
-    ushort* entry = extendedCharTable[hash];
+    uint* entry = extendedCharTable[hash];
 
-    // compare given length with stored sequence length ( given as the first ushort in the
+    // compare given length with stored sequence length ( given as the first uint in the
     // stored buffer )
     if ( entry == 0 || entry[0] != length )
         return false;
@@ -384,7 +656,7 @@ bool ExtendedCharTable::extendedCharMatch(ushort hash , ushort* unicodePoints ,
     }
     return true;
 }
-ushort ExtendedCharTable::createExtendedChar(ushort* unicodePoints , ushort length)
+ushort ExtendedCharTable::createExtendedChar(uint* unicodePoints , ushort length)
 {
     // look for this sequence of points in the table
     ushort hash = extendedCharHash(unicodePoints,length);
@@ -409,7 +681,7 @@ ushort ExtendedCharTable::createExtendedChar(ushort* unicodePoints , ushort leng
     
     // add the new sequence to the table and
     // return that index
-    ushort* buffer = new ushort[length+1];
+    uint* buffer = new uint[length+1];
     buffer[0] = length;
     for ( int i = 0 ; i < length ; i++ )
         buffer[i+1] = unicodePoints[i];
@@ -419,12 +691,12 @@ ushort ExtendedCharTable::createExtendedChar(ushort* unicodePoints , ushort leng
     return hash;
 }
 
-ushort* ExtendedCharTable::lookupExtendedChar(ushort hash , ushort& length) const
+uint* ExtendedCharTable::lookupExtendedChar(ushort hash , ushort& length) const
 {
     // lookup index in table and if found, set the length
     // argument and return a pointer to the character sequence
 
-    ushort* buffer = extendedCharTable[hash];
+    uint* buffer = extendedCharTable[hash];
     if ( buffer )
     {
         length = buffer[0];
@@ -443,7 +715,7 @@ ExtendedCharTable::ExtendedCharTable()
 ExtendedCharTable::~ExtendedCharTable()
 {
     // free all allocated character buffers
-    QHashIterator<ushort,ushort*> iter(extendedCharTable);
+    QHashIterator<ushort,uint*> iter(extendedCharTable);
     while ( iter.hasNext() )
     {
         iter.next();
@@ -30,6 +30,8 @@
 #pragma once
 
 // Own includes
+#include "triggersequencescanner.h"
+#include "utf8decoder.h"
 class KeyboardTranslator;
 class HistoryType;
 class Screen;
@@ -40,7 +42,10 @@ class TerminalCharacterDecoder;
 #include <stdio.h>
 
 // Qt includes
+#include <QAtomicInt>
+#include <QElapsedTimer>
 #include <QKeyEvent>
+#include <QMutex>
 #include <QTextCodec>
 #include <QTextStream>
 #include <QTimer>
@@ -214,6 +219,52 @@ public:
    */
     bool programUsesMouse() const;
 
+    /**
+     * Returns the lock which guards the screens of the emulation.
+     *
+     * receiveData() holds the lock while it modifies the screens, and the
+     * screen windows created with createWindow() hold it while they read
+     * from them.  This allows receiveData() to be called from a worker thread
+     * while the views are painted in the GUI thread.  The lock is recursive.
+     */
+    QMutex* screenLock() const;
+
+    /**
+     * Returns the longest time in milliseconds that outputChanged() is held
+     * back while output keeps arriving.
+     *
+     * The interval grows with the time the views take to update, so that
+     * a flood of output does not keep the GUI busy redrawing.  It is never
+     * shorter than 40ms.
+     */
+    int frameInterval() const;
+
+    /**
+     * Returns a moving average of the rate at which output arrives from the
+     * terminal program, in bytes per second.  Updated whenever
+     * outputChanged() is emitted.
+     */
+    double inputRate() const;
+
+    /**
+     * Returns a moving average of the time in milliseconds the screen windows
+     * and views take per frame, to take in an updated image when
+     * outputChanged() is emitted and to paint it.
+     */
+    double renderCost() const;
+
+    /**
+     * Starts watching the incoming byte stream for @p sequence and returns
+     * an id for it.  triggerSequenceDetected() is emitted with this id
+     * whenever the sequence is received, including when it is split across
+     * several calls to receiveData().  The sequence is still passed on to
+     * the terminal emulation as usual.
+     */
+    int addTriggerSequence(const QByteArray& sequence);
+
+    /** Stops watching for a sequence added with addTriggerSequence(). */
+    void removeTriggerSequence(int id);
+
 public slots: 
 
     /** Change the size of the emulation's image */
@@ -251,10 +302,18 @@ public slots:
    * character buffer using the current codec(), and then calls receiveChar() for
    * each unicode character in the resulting buffer.
    *
+   * UTF-8 input is decoded incrementally without building a QString, and runs
+   * of printable ASCII characters are passed to receivePrintableRun() as a whole.
+   * Runs of other printable characters are passed to receivePrintableCodePoints().
+   * Multi-byte sequences may be split across calls.
+   *
    * receiveData() also starts a timer which causes the outputChanged() signal
    * to be emitted when it expires.  The timer allows multiple updates in quick
    * succession to be buffered into a single outputChanged() signal emission.
    *
+   * receiveData() may be called from a thread other than the one the emulation
+   * lives in, in which case the timer is started through the event loop.
+   *
    * @param buffer A string of characters received from the terminal program.
    * @param len The length of @p buffer
    */
@@ -287,9 +346,16 @@ signals:
    */
     void stateSet(int state);
 
-    /** TODO Document me */
+    /** Emitted when the start of a ZModem transfer ("\030B00") is received. */
     void zmodemDetected();
 
+    /**
+     * Emitted when a sequence added with addTriggerSequence() is received.
+     *
+     * @param id The id returned by addTriggerSequence()
+     */
+    void triggerSequenceDetected(int id);
+
 
     /**
    * Requests that the color of the text used
@@ -384,6 +450,22 @@ signals:
    */
     void flowControlKeyPressed(bool suspendKeyPressed);
 
+    /**
+     * Requests that small blocks of output from the terminal program be
+     * held back for up to @p msecs milliseconds and passed to receiveData()
+     * together.  Emitted with a non-zero interval while the terminal is
+     * flooded with output and with 0 once it calms down again.
+     */
+    void inputCoalescingRequest(int msecs);
+
+    /**
+     * Requests that reading output from the terminal program be stopped
+     * (@p suspend is true) or resumed.  Reading is stopped for a short while
+     * when parsing and updating the views leave the event loop with no time
+     * to spare, so that the terminal program is throttled instead.
+     */
+    void inputSuspendRequest(bool suspend);
+
 protected:
     virtual void setMode(int mode) = 0;
     virtual void resetMode(int mode) = 0;
@@ -394,6 +476,30 @@ protected:
    */
     virtual void receiveChar(int ch);
 
+    /**
+   * Processes a run of printable ASCII characters (0x20 to 0x7E) from the
+   * incoming stream in one go.  See receiveData()
+   *
+   * The default implementation calls receiveChar() for each character.
+   * Emulations can reimplement this to avoid the per character overhead.
+   *
+   * @p text The characters, which are not null terminated.
+   * @p length The number of characters in @p text.
+   */
+    virtual void receivePrintableRun(const char* text, int length);
+
+    /**
+   * Processes a run of decoded characters from the incoming stream which
+   * are neither ASCII nor C1 control characters (U+00A0 and above) in one go.
+   * See receiveData()
+   *
+   * The default implementation calls receiveChar() for each character.
+   *
+   * @p codePoints The unicode code points of the characters.
+   * @p length The number of characters in @p codePoints.
+   */
+    virtual void receivePrintableCodePoints(const uint* codePoints, int length);
+
     /**
    * Sets the active screen.  The terminal has two screens, primary and alternate.
    * The primary screen is used by default.  When certain interactive programs such
@@ -426,8 +532,13 @@ protected:
     //the current text codec.  (this allows for rendering of non-ASCII characters in text files etc.)
     const QTextCodec* _codec;
     QTextDecoder* _decoder;
+    Utf8Decoder _utf8Decoder; // used instead of _decoder if the codec is UTF-8
+    TriggerSequenceScanner _triggerSequenceScanner;
+    int _zmodemTrigger;
     const KeyboardTranslator* _keyTranslator; // the keyboard layout
 
+    mutable QMutex _screenMutex; // see screenLock()
+
 protected slots:
     /**
    * Schedules an update of attached views.
@@ -436,6 +547,13 @@ protected slots:
    */
     void bufferedUpdate();
 
+    /**
+     * Emits sendData() with the contents of @p data.  Used to pass data which
+     * is produced on a worker thread to the emulation's thread, since the
+     * buffer given to sendData() does not outlive the emission.
+     */
+    void sendQueuedData(QByteArray data);
+
 private slots: 
 
     // triggered by timer, causes the emulation to send an updated screen image to each
@@ -444,10 +562,33 @@ private slots:
 
     void usesMouseChanged(bool usesMouse);
 
+    void resumeInput();
+
+    // adds the time a view took to paint to the render cost of the frame
+    void addPaintTime(double msecs);
+
 private:
+    void receiveUtf8Data(const char* text, int length);
+    void receiveCodePoint(uint codePoint);
+    void updateSchedule(double updateTime);
+
     bool _usesMouse;
     QTimer _bulkTimer1;
     QTimer _bulkTimer2;
+    QAtomicInt _updatePending; // bufferedUpdate() is queued from a worker thread
+
+    // adaptive update scheduling, see updateSchedule()
+    QElapsedTimer _frameClock;   // time since outputChanged() was last emitted
+    QAtomicInt _inputBytes;      // bytes received since then
+    QAtomicInt _parseTime;       // microseconds spent in receiveData() since then
+    double _paintTime;           // milliseconds the views spent painting since then
+    double _inputRate;
+    double _renderCost;
+    int _frameInterval;
+    int _coalescingInterval;
+    int _overloadedFrames;
+    bool _inputSuspended;
+    QTimer _resumeInputTimer;
 
 };
 
@@ -35,6 +35,8 @@
 #include "shellcommand.h"
 #include "vt102emulation.h"
 #include "pseudoterminalprocess.h"
+#include "pseudoterminaldevice.h"
+#include "emulationworker.h"
 
 // Standard includes
 #include <assert.h>
@@ -48,20 +50,32 @@
 #include <QRegExp>
 #include <QStringList>
 #include <QFile>
+#include <QMetaMethod>
 #include <QtDebug>
 
 int TerminalSession::lastSessionId = 0;
 
+// bytes which may be queued for the emulation thread before reading from the
+// terminal program is suspended
+#define MAX_EMULATION_BACKLOG (4 * 1024 * 1024)
+
 TerminalSession::TerminalSession(QObject* parent) :
     QObject(parent),
     _shellProcess(0)
   , _terminalEmulation(0)
+  , _emulationThread(0)
+  , _emulationWorker(0)
+  , _inputSuspendRequested(false)
+  , _emulationBacklogged(false)
   , _monitorActivity(false)
   , _monitorSilence(false)
   , _notifiedActivity(false)
   , _autoClose(true)
   , _wantedClose(false)
   , _silenceSeconds(10)
+  , _receivedByteCount(0)
+  , _receivedBlockCount(0)
+  , _receivedTextConversionCount(0)
   , _addToUtmp(false)
   , _flowControl(true)
   , _fullScripting(false)
@@ -92,6 +106,12 @@ TerminalSession::TerminalSession(QObject* parent) :
              SLOT(sendData(const char *,int)) );
     connect( _terminalEmulation,SIGNAL(useUtf8Request(bool)),_shellProcess,SLOT(setUtf8Mode(bool)) );
 
+    // let the emulation throttle the terminal program when it falls behind
+    connect( _terminalEmulation,SIGNAL(inputCoalescingRequest(int)),_shellProcess,
+             SLOT(setReadCoalescing(int)) );
+    connect( _terminalEmulation,SIGNAL(inputSuspendRequest(bool)),this,
+             SLOT(onInputSuspendRequest(bool)) );
+
     connect( _shellProcess,SIGNAL(finished(int,QProcess::ExitStatus)), this, SLOT(done(int)) );
     // not in kprocess anymore connect( _shellProcess,SIGNAL(done(int)), this, SLOT(done(int)) );
 
@@ -516,6 +536,7 @@ void TerminalSession::sendText(QString text) const
 
 TerminalSession::~TerminalSession()
 {
+    setThreadedEmulation(false);
     delete _terminalEmulation;
     delete _shellProcess;
     //  delete _zmodemProc;
@@ -732,8 +753,118 @@ bool TerminalSession::flowControlEnabled() const
 
 void TerminalSession::onReceiveBlock( const char * buf, int len )
 {
-    _terminalEmulation->receiveData( buf, len );
-    emit receivedData( QString::fromLatin1( buf, len ) );
+    _receivedByteCount += len;
+    _receivedBlockCount++;
+
+    if ( _emulationWorker ) {
+        // buf is only valid during this call, so the worker gets a copy
+        _emulationWorker->queueData( buf, len );
+
+        // stop reading rather than queueing up more and more output while
+        // the worker can't keep up
+        if ( !_emulationBacklogged && _emulationWorker->pendingBytes() > MAX_EMULATION_BACKLOG ) {
+            _emulationBacklogged = true;
+            updateReadSuspended();
+        }
+    } else {
+        _terminalEmulation->receiveData( buf, len );
+    }
+    emit receivedRawData( buf, len );
+
+    // only pay for the Latin-1 conversion if somebody is listening
+    static const QMetaMethod receivedDataSignal = QMetaMethod::fromSignal(&TerminalSession::receivedData);
+    if ( isSignalConnected(receivedDataSignal) ) {
+        _receivedTextConversionCount++;
+        emit receivedData( QString::fromLatin1( buf, len ) );
+    }
+}
+
+quint64 TerminalSession::receivedByteCount() const
+{
+    return _receivedByteCount;
+}
+
+quint64 TerminalSession::receivedBlockCount() const
+{
+    return _receivedBlockCount;
+}
+
+quint64 TerminalSession::receivedTextConversionCount() const
+{
+    return _receivedTextConversionCount;
+}
+
+void TerminalSession::setThreadedEmulation(bool threaded)
+{
+    if ( threaded == isThreadedEmulation() )
+        return;
+
+    if ( threaded ) {
+        _emulationThread = new QThread();
+        _emulationWorker = new EmulationWorker( _terminalEmulation );
+        _emulationWorker->setDrainThreshold( MAX_EMULATION_BACKLOG / 4 );
+        _emulationWorker->moveToThread( _emulationThread );
+        connect( _emulationWorker, SIGNAL(drained()), this, SLOT(onEmulationDrained()) );
+        _emulationThread->start();
+    } else {
+        // let the worker finish the blocks which are still queued before
+        // the emulation is fed from the GUI thread again
+        QMetaObject::invokeMethod( _emulationWorker, "receiveData", Qt::BlockingQueuedConnection,
+                                   Q_ARG(QByteArray, QByteArray()) );
+        _emulationThread->quit();
+        _emulationThread->wait();
+
+        delete _emulationWorker;
+        delete _emulationThread;
+        _emulationWorker = 0;
+        _emulationThread = 0;
+
+        if ( _emulationBacklogged ) {
+            _emulationBacklogged = false;
+            updateReadSuspended();
+        }
+    }
+}
+
+void TerminalSession::setReadBudget(int bytes, int msecs)
+{
+    _shellProcess->setReadBudget(bytes, msecs);
+}
+
+double TerminalSession::readsPerSecond() const
+{
+    PseudoTerminalReadStatistics statistics = _shellProcess->readStatistics();
+    return statistics.elapsed > 0 ? statistics.reads * 1000.0 / statistics.elapsed : 0;
+}
+
+double TerminalSession::bytesPerRead() const
+{
+    PseudoTerminalReadStatistics statistics = _shellProcess->readStatistics();
+    return statistics.reads ? double(statistics.bytes) / statistics.reads : 0;
+}
+
+void TerminalSession::onInputSuspendRequest(bool suspend)
+{
+    _inputSuspendRequested = suspend;
+    updateReadSuspended();
+}
+
+void TerminalSession::onEmulationDrained()
+{
+    if ( _emulationBacklogged ) {
+        _emulationBacklogged = false;
+        updateReadSuspended();
+    }
+}
+
+void TerminalSession::updateReadSuspended()
+{
+    _shellProcess->setReadSuspended( _inputSuspendRequested || _emulationBacklogged );
+}
+
+bool TerminalSession::isThreadedEmulation() const
+{
+    return _emulationWorker != 0;
 }
 
 QSize TerminalSession::size()
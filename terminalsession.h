@@ -33,12 +33,14 @@
 
 // Own includes
 #include "history.h"
+class EmulationWorker;
 class PseudoTerminalProcess;
 class TerminalDisplay;
 class TerminalEmulation;
 
 // Qt includes
 #include <QStringList>
+#include <QThread>
 #include <QWidget>
 
 /**
@@ -338,6 +340,56 @@ public:
     /** Sets the text codec used by this session's terminal emulation. */
     void setCodec(QTextCodec * codec);
 
+    /**
+     * Returns the total number of bytes received from the terminal process
+     * since the session was created.
+     */
+    quint64 receivedByteCount() const;
+
+    /**
+     * Returns the number of blocks the bytes counted by receivedByteCount()
+     * arrived in.
+     */
+    quint64 receivedBlockCount() const;
+
+    /**
+     * Returns the number of received blocks which had to be converted into
+     * a QString because something was connected to receivedData(QString).
+     */
+    quint64 receivedTextConversionCount() const;
+
+    /**
+     * Enables or disables parsing of the terminal program's output on a
+     * dedicated thread.
+     *
+     * The pseudo terminal is still read in the GUI thread, but each block of
+     * output is copied and handed to a worker thread, which runs the terminal
+     * emulation and updates the screens.  This keeps the GUI responsive while
+     * large amounts of output are processed.  Disabled by default.
+     */
+    void setThreadedEmulation(bool threaded);
+    /** Returns true if the output is parsed on a dedicated thread. */
+    bool isThreadedEmulation() const;
+
+    /**
+     * Lets the session read up to @p bytes bytes of output from the terminal
+     * program each time output becomes available, for at most @p msecs
+     * milliseconds if @p msecs is greater than 0, instead of only what is
+     * available at that moment.  Everything read in one go is passed to the
+     * emulation as one block.  A budget of 0 bytes, the default, turns this
+     * off.
+     */
+    void setReadBudget(int bytes, int msecs = 0);
+
+    /**
+     * Returns the average number of read() calls per second made on the
+     * terminal since it was opened.
+     */
+    double readsPerSecond() const;
+
+    /** Returns the average number of bytes returned by a read() call. */
+    double bytesPerRead() const;
+
     /**
      * Attempts to get the shell program to redraw the current display area.
      * This can be used after clearing the screen, for example, to get the
@@ -379,9 +431,24 @@ signals:
 
     /**
      * Emitted when output is received from the terminal process.
+     *
+     * Each byte of the output is converted to a character as if it was
+     * Latin-1 encoded.  The conversion is skipped entirely when nothing is
+     * connected to this signal; prefer receivedRawData() where possible.
      */
     void receivedData( QString text );
 
+    /**
+     * Emitted when output is received from the terminal process, before it
+     * is converted in any way.
+     *
+     * @param data Pointer to the received bytes.  It is only valid while the
+     * signal is being emitted, so receivers which want to keep the data
+     * must copy it and must be connected with a direct connection.
+     * @param length The number of bytes in @p data.
+     */
+    void receivedRawData( const char * data, int length );
+
     /** Emitted when the session's title has changed. */
     void titleChanged();
 
@@ -455,14 +522,22 @@ private slots:
 
     void viewDestroyed(QObject * view);
 
+    void onInputSuspendRequest(bool suspend);
+    void onEmulationDrained();
+
 private:
     void updateTerminalSize();
+    void updateReadSuspended();
     WId windowId() const;
 
     int            _uniqueIdentifier;
 
     PseudoTerminalProcess     *_shellProcess;
     TerminalEmulation  *  _terminalEmulation;
+    QThread    *   _emulationThread;
+    EmulationWorker * _emulationWorker;
+    bool           _inputSuspendRequested; // by the emulation, see TerminalEmulation::inputSuspendRequest()
+    bool           _emulationBacklogged;   // too much output is queued for _emulationWorker
 
     QList<TerminalDisplay *> _views;
 
@@ -476,6 +551,10 @@ private:
 
     int            _silenceSeconds;
 
+    quint64        _receivedByteCount;
+    quint64        _receivedBlockCount;
+    quint64        _receivedTextConversionCount;
+
     QString        _nameTitle;
     QString        _displayTitle;
     QString        _userTitle;
@@ -67,13 +67,15 @@ void TerminalWidget::findPrevious() {
 
 void TerminalWidget::search(bool forwards, bool next) {
     int startColumn, startLine;
-    
+
+    QMutexLocker locker(_terminalSession->emulation()->screenLock());
     if (next) {
         _terminalDisplay->screenWindow()->screen()->getSelectionEnd(startColumn, startLine);
         startColumn++;
     } else {
         _terminalDisplay->screenWindow()->screen()->getSelectionStart(startColumn, startLine);
     }
+    locker.unlock();
 
     QRegExp regExp(_searchBar->searchText());
     regExp.setPatternSyntax(_searchBar->useRegularExpression() ? QRegExp::RegExp : QRegExp::FixedString);
@@ -362,6 +364,10 @@ void TerminalWidget::setHistorySize(int lines) {
         _terminalSession->setHistoryType(HistoryTypeBuffer(lines));
 }
 
+void TerminalWidget::setCompressedHistory(int uncompressedLines) {
+    _terminalSession->setHistoryType(CompressedHistoryType(qMax(uncompressedLines, 1)));
+}
+
 void TerminalWidget::setScrollBarPosition(ScrollBarPosition pos) {
     if (!_terminalDisplay)
         return;
@@ -457,6 +463,14 @@ void TerminalWidget::setFlowControlWarningEnabled(bool enabled) {
     }
 }
 
+void TerminalWidget::setThreadedEmulation(bool threaded) {
+    _terminalSession->setThreadedEmulation(threaded);
+}
+
+void TerminalWidget::setReadBudget(int bytes, int msecs) {
+    _terminalSession->setReadBudget(bytes, msecs);
+}
+
 void TerminalWidget::setEnvironment(QStringList environment) {
     _terminalSession->setEnvironment(environment);
 }
@@ -466,30 +480,37 @@ void TerminalWidget::setMotionAfterPasting(int action) {
 }
 
 int TerminalWidget::historyLinesCount() {
+    QMutexLocker locker(_terminalSession->emulation()->screenLock());
     return _terminalDisplay->screenWindow()->screen()->getHistLines();
 }
 
 int TerminalWidget::screenColumnsCount() {
+    QMutexLocker locker(_terminalSession->emulation()->screenLock());
     return _terminalDisplay->screenWindow()->screen()->getColumns();
 }
 
 void TerminalWidget::setSelectionStart(int row, int column) {
+    QMutexLocker locker(_terminalSession->emulation()->screenLock());
     _terminalDisplay->screenWindow()->screen()->setSelectionStart(column, row, true);
 }
 
 void TerminalWidget::setSelectionEnd(int row, int column) {
+    QMutexLocker locker(_terminalSession->emulation()->screenLock());
     _terminalDisplay->screenWindow()->screen()->setSelectionEnd(column, row);
 }
 
 void TerminalWidget::selectionStart(int& row, int& column) {
+    QMutexLocker locker(_terminalSession->emulation()->screenLock());
     _terminalDisplay->screenWindow()->screen()->getSelectionStart(column, row);
 }
 
 void TerminalWidget::selectionEnd(int& row, int& column) {
+    QMutexLocker locker(_terminalSession->emulation()->screenLock());
     _terminalDisplay->screenWindow()->screen()->getSelectionEnd(column, row);
 }
 
 QString TerminalWidget::selectedText(bool preserveLineBreaks) {
+    QMutexLocker locker(_terminalSession->emulation()->screenLock());
     return _terminalDisplay->screenWindow()->screen()->selectedText(preserveLineBreaks);
 }
 
@@ -119,6 +119,12 @@ public:
     /** Sets the history size for scrolling in lines. */
     void setHistorySize(int lines); //infinite if lines < 0
 
+    /**
+     * Keeps an unlimited history in memory, compressing all lines except
+     * the most recent @p uncompressedLines.
+     */
+    void setCompressedHistory(int uncompressedLines = 1000);
+
     /** Sets the scrollbar position. */
     void setScrollBarPosition(ScrollBarPosition);
 
@@ -140,6 +146,18 @@ public:
      */
     void setFlowControlWarningEnabled(bool enabled);
 
+    /**
+     * Sets whether the output of the terminal program is parsed on a
+     * dedicated thread instead of the GUI thread.
+     */
+    void setThreadedEmulation(bool threaded);
+
+    /**
+     * Sets how much output is read from the terminal program in one go.
+     * See TerminalSession::setReadBudget()
+     */
+    void setReadBudget(int bytes, int msecs = 0);
+
     /** Get all available keyboard bindings. */
     static QStringList availableKeyBindings();
 
@@ -0,0 +1,6 @@
+TARGET = tst_charactercolor
+
+include(../tests.pri)
+
+SOURCES += \
+    tst_charactercolor.cpp
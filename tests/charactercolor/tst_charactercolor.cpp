@@ -0,0 +1,208 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+// Own includes
+#include "history.h"
+#include "screen.h"
+
+// Qt includes
+#include <QtTest>
+
+namespace
+{
+
+// returns the n-th of a sequence of distinct RGB colors
+int rgb(int n)
+{
+    return (n * 2654435761u) & 0xffffff;
+}
+
+QColor colorAt(const Screen& screen, int line, int column)
+{
+    QVector<Character> image(screen.getColumns());
+    screen.getImage(image.data(), image.size(), line, line);
+    return image.at(column).foregroundColor.color(base_color_table, screen.rgbColorTable());
+}
+
+// sets more RGB colors than the table can hold, writing each to the top
+// left character of the screen
+void useManyColors(Screen& screen, int first)
+{
+    for (int i = first; i < first + 2 * RgbColorTable::Capacity; i++)
+    {
+        screen.home();
+        screen.setForeColor(COLOR_SPACE_RGB, rgb(i));
+        screen.displayCharacter('x');
+    }
+}
+
+}
+
+class TestCharacterColor : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void unusedColorsAreReclaimed();
+    void screenColorsAreKept();
+    void historyColorsAreKept();
+    void fullTableOfHistoryColors();
+    void bytesPerCell_data();
+    void bytesPerCell();
+};
+
+void TestCharacterColor::unusedColorsAreReclaimed()
+{
+    Screen screen(5, 10);
+
+    const int first = 0;
+    useManyColors(screen, first);
+
+    const int last = first + 2 * RgbColorTable::Capacity - 1;
+    QCOMPARE(colorAt(screen, 0, 0), QColor(QRgb(rgb(last))));
+}
+
+void TestCharacterColor::screenColorsAreKept()
+{
+    Screen screen(5, 100);
+
+    screen.setCursorYX(2, 1);
+    for (int i = 0; i < 100; i++)
+    {
+        screen.setForeColor(COLOR_SPACE_RGB, rgb(i));
+        screen.displayCharacter('x');
+    }
+
+    useManyColors(screen, 100);
+
+    for (int i = 0; i < 100; i++)
+        QCOMPARE(colorAt(screen, 1, i), QColor(QRgb(rgb(i))));
+}
+
+void TestCharacterColor::historyColorsAreKept()
+{
+    Screen screen(5, 10);
+    screen.setScroll(CompactHistoryType(1000));
+
+    screen.setForeColor(COLOR_SPACE_RGB, rgb(0));
+    screen.displayCharacter('x');
+    screen.setCursorYX(5, 1);
+    screen.index();
+    QCOMPARE(screen.getHistLines(), 1);
+
+    useManyColors(screen, 1);
+
+    QCOMPARE(colorAt(screen, 0, 0), QColor(QRgb(rgb(0))));
+}
+
+void TestCharacterColor::fullTableOfHistoryColors()
+{
+    Screen screen(5, 10);
+    screen.setScroll(CompactHistoryType(RgbColorTable::Capacity + 10));
+
+    // fill the table with colors of lines which stay in the history
+    for (int i = 0; i < RgbColorTable::Capacity; i++)
+    {
+        screen.setForeColor(COLOR_SPACE_RGB, rgb(i));
+        screen.displayCharacter('x');
+        screen.toStartOfLine();
+        screen.index();
+    }
+    QCOMPARE(screen.rgbColorTable()->count(), int(RgbColorTable::Capacity));
+
+    // new colors are approximated without scanning for unused ones each time
+    int n = RgbColorTable::Capacity;
+    QBENCHMARK
+    {
+        for (int i = 0; i < RgbColorTable::Capacity; i++)
+        {
+            screen.home();
+            screen.setForeColor(COLOR_SPACE_RGB, rgb(n++));
+            screen.displayCharacter('x');
+        }
+    }
+    QCOMPARE(colorAt(screen, 0, 0), QColor(QRgb(rgb(0))));
+
+    // once the first lines are dropped from the history their colors are
+    // given back
+    screen.setDefaultRendition();
+    screen.setCursorYX(5, 1);
+    for (int i = 0; i < 20; i++)
+        screen.index();
+    QVERIFY(screen.droppedLines() > 0);
+
+    screen.home();
+    screen.setForeColor(COLOR_SPACE_RGB, rgb(n));
+    screen.displayCharacter('x');
+    const int historyLines = screen.getHistLines();
+    QCOMPARE(colorAt(screen, historyLines, 0), QColor(QRgb(rgb(n))));
+}
+
+void TestCharacterColor::bytesPerCell_data()
+{
+    QTest::addColumn<int>("colorSpace");
+
+    QTest::newRow("default") << int(COLOR_SPACE_DEFAULT);
+    QTest::newRow("256 colors") << int(COLOR_SPACE_256);
+    QTest::newRow("rgb") << int(COLOR_SPACE_RGB);
+}
+
+void TestCharacterColor::bytesPerCell()
+{
+    QFETCH(int, colorSpace);
+
+    const int lineCount = 1000;
+    const int columns = 100;
+
+    // every ten characters change color, like highlighted source code,
+    // using a thousand different colors
+    RgbColorTable rgbColors;
+    CompactHistoryScroll history(lineCount);
+    QVector<Character> line(columns);
+    for (int i = 0; i < lineCount; i++)
+    {
+        for (int column = 0; column < columns; column++)
+        {
+            const int n = (i * columns + column) / 10 % 1000;
+            const int value = (colorSpace == COLOR_SPACE_DEFAULT) ? (n & 1) :
+                              (colorSpace == COLOR_SPACE_256) ? (n & 255) : rgb(n);
+            line[column] = Character('a' + column % 26,
+                                     CharacterColor(colorSpace, value, &rgbColors));
+        }
+        history.addCellsVector(line);
+        history.addLine(false);
+    }
+
+    // the screen and views keep sizeof(Character) bytes for every cell
+    QCOMPARE(int(sizeof(Character)), 8);
+
+    const CompactHistoryStatistics statistics = history.memoryStatistics();
+    QTest::setBenchmarkResult(qreal(statistics.usedBytes) / (lineCount * columns),
+                              QTest::BytesAllocated);
+}
+
+QTEST_MAIN(TestCharacterColor)
+
+#include "tst_charactercolor.moc"
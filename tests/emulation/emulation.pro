@@ -0,0 +1,6 @@
+TARGET = tst_emulation
+
+include(../tests.pri)
+
+SOURCES += \
+    tst_emulation.cpp
@@ -0,0 +1,132 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+// Own includes
+#include "vt102emulation.h"
+#include "terminalcharacterdecoder.h"
+
+// Qt includes
+#include <QtTest>
+
+namespace
+{
+
+// returns the text of the history and the screen, without empty lines at the end
+QStringList plainText(Vt102Emulation& emulation)
+{
+    QString text;
+    QTextStream stream(&text);
+    PlainTextDecoder decoder;
+    decoder.setTrailingWhitespace(false);
+    decoder.begin(&stream);
+    emulation.writeToStream(&decoder, 0, emulation.lineCount() - 1);
+    decoder.end();
+
+    QStringList result = text.split(QLatin1Char('\n'));
+    while (!result.isEmpty() && result.last().isEmpty())
+        result.removeLast();
+    return result;
+}
+
+}
+
+class TestEmulation : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void printableCodePoints();
+    void receiveData_data();
+    void receiveData();
+};
+
+void TestEmulation::printableCodePoints()
+{
+    Vt102Emulation emulation;
+    emulation.setCodec(QTextCodec::codecForName("UTF-8"));
+    emulation.setImageSize(10, 20);
+
+    // double-width characters mixed with ASCII
+    const char wide[] = "\xe4\xb8\xad\xe6\x96\x87 caf\xc3\xa9\r\n";
+    emulation.receiveData(wide, sizeof(wide) - 1);
+
+    // non-ASCII characters inside an operating system command are not displayed
+    const char title[] = "\033]0;t\xc3\xaftle\007\xc3\xbc\r\n";
+    emulation.receiveData(title, sizeof(title) - 1);
+
+    // a sequence split across two calls
+    emulation.receiveData("\xe2\x82", 2);
+    emulation.receiveData("\xac\r\n", 3);
+
+    // a run which does not fit on the rest of the line wraps, the
+    // wrapped line is written to the stream without a line break
+    QByteArray text;
+    for (int i = 0; i < 11; i++)
+        text.append("\xe4\xb8\x80");
+    emulation.receiveData(text.constData(), text.size());
+
+    QStringList lines = plainText(emulation);
+    QCOMPARE(lines.size(), 4);
+    QCOMPARE(lines.at(0), QString::fromUtf8("\xe4\xb8\xad\xe6\x96\x87 caf\xc3\xa9"));
+    QCOMPARE(lines.at(1), QString::fromUtf8("\xc3\xbc"));
+    QCOMPARE(lines.at(2), QString::fromUtf8("\xe2\x82\xac"));
+    QCOMPARE(lines.at(3), QString::fromUtf8(text));
+}
+
+void TestEmulation::receiveData_data()
+{
+    QTest::addColumn<QByteArray>("line");
+
+    QTest::newRow("ascii") << QByteArray("The quick brown fox jumps over the lazy dog.");
+    QTest::newRow("latin") << QByteArray("Der Fu\xc3\x9f\xc3\xa4nger \xc3\xbc"
+                                         "berquert die Stra\xc3\x9f" "e.");
+    QTest::newRow("cjk") << QByteArray("\xe6\x95\x8f\xe6\x8d\xb7\xe7\x9a\x84\xe6\xa3\x95"
+                                       "\xe8\x89\xb2\xe7\x8b\x90\xe7\x8b\xb8\xe8\xb7\xb3"
+                                       "\xe8\xbf\x87\xe4\xba\x86\xe9\x82\xa3\xe5\x8f\xaa"
+                                       "\xe6\x87\x92\xe7\x8b\x97");
+}
+
+void TestEmulation::receiveData()
+{
+    QFETCH(QByteArray, line);
+
+    Vt102Emulation emulation;
+    emulation.setCodec(QTextCodec::codecForName("UTF-8"));
+    emulation.setImageSize(50, 200);
+
+    // about a megabyte of output, without escape sequences
+    QByteArray data;
+    while (data.size() < 1024 * 1024)
+        data.append(line).append("\r\n");
+
+    QBENCHMARK
+    {
+        emulation.receiveData(data.constData(), data.size());
+    }
+}
+
+QTEST_MAIN(TestEmulation)
+
+#include "tst_emulation.moc"
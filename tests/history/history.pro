@@ -0,0 +1,6 @@
+TARGET = tst_history
+
+include(../tests.pri)
+
+SOURCES += \
+    tst_history.cpp
@@ -0,0 +1,182 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+// Own includes
+#include "history.h"
+
+// Qt includes
+#include <QtTest>
+
+class TestHistory : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void getCharacters_data();
+    void getCharacters();
+    void appendToFullHistory_data();
+    void appendToFullHistory();
+    void reflowOnlyInMemory_data();
+    void reflowOnlyInMemory();
+};
+
+void TestHistory::getCharacters_data()
+{
+    QTest::addColumn<uint>("firstCharacter");
+
+    QTest::newRow("bmp") << uint('a');
+    QTest::newRow("beyond bmp") << uint(0x1F600);
+}
+
+void TestHistory::getCharacters()
+{
+    QFETCH(uint, firstCharacter);
+
+    // several hundred format runs of one to four characters, every fourth
+    // of them a single character
+    TextLine text;
+    int runCount = 0;
+    while (text.size() < 1000)
+    {
+        const int runLength = (runCount % 4 == 0) ? 1 : 1 + runCount % 7 % 4;
+        const CharacterColor foreground(COLOR_SPACE_256, 16 + runCount % 200);
+        const CharacterColor background(COLOR_SPACE_SYSTEM, runCount % 8);
+        const quint8 rendition = (runCount % 3 == 0) ? RE_BOLD : DEFAULT_RENDITION;
+        for (int i = 0; i < runLength; i++)
+            text.append(Character(firstCharacter + text.size() % 26, foreground, background, rendition));
+        runCount++;
+    }
+    QVERIFY(runCount > 300);
+
+    CompactHistoryBlockList blockList;
+    CompactHistoryLine* line = new(blockList) CompactHistoryLine(text, blockList);
+    QCOMPARE(int(line->getLength()), text.size());
+
+    QVector<Character> expected(text.size());
+    for (int column = 0; column < text.size(); column++)
+        line->getCharacter(column, expected[column]);
+    QVERIFY(expected == text);
+
+    // start at every column, which covers the middle of runs and single
+    // character runs, and read one character, a few runs or up to the end
+    QVector<Character> characters(text.size());
+    for (int startColumn = 0; startColumn < text.size(); startColumn++)
+    {
+        const int lengths[] = { 1, qMin(13, text.size() - startColumn), text.size() - startColumn };
+        for (int i = 0; i < 3; i++)
+        {
+            const int length = lengths[i];
+            line->getCharacters(characters.data(), length, startColumn);
+            for (int column = 0; column < length; column++)
+            {
+                QVERIFY2(characters.at(column) == expected.at(startColumn + column),
+                         qPrintable(QString("start column %1, length %2, column %3")
+                                    .arg(startColumn).arg(length).arg(startColumn + column)));
+            }
+        }
+    }
+
+    delete line;
+}
+
+void TestHistory::appendToFullHistory_data()
+{
+    QTest::addColumn<int>("lineCount");
+
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+    QTest::newRow("1M") << 1000000;
+}
+
+void TestHistory::appendToFullHistory()
+{
+    QFETCH(int, lineCount);
+
+    TextLine text(40);
+    for (int i = 0; i < text.size(); i++)
+        text[i] = Character('a' + i % 26, CharacterColor(COLOR_SPACE_256, 16 + i / 8));
+
+    // once the history is full, every line which is added replaces the
+    // oldest one, which should cost the same however long the history is
+    CompactHistoryScroll history(lineCount);
+    for (int i = 0; i < lineCount; i++)
+    {
+        history.addCellsVector(text);
+        history.addLine(false);
+    }
+    QCOMPARE(history.getLines(), lineCount);
+
+    QBENCHMARK
+    {
+        history.addCellsVector(text);
+        history.addLine(false);
+    }
+
+    QCOMPARE(history.getLines(), lineCount);
+}
+
+void TestHistory::reflowOnlyInMemory_data()
+{
+    QTest::addColumn<int>("type");
+    QTest::addColumn<int>("expectedLines");
+
+    // the line of 20 characters is wrapped at 10 columns in memory only
+    QTest::newRow("compact") << 0 << 2;
+    QTest::newRow("buffer") << 1 << 2;
+    QTest::newRow("file") << 2 << 1;
+    QTest::newRow("compressed") << 3 << 1;
+}
+
+void TestHistory::reflowOnlyInMemory()
+{
+    QFETCH(int, type);
+    QFETCH(int, expectedLines);
+
+    HistoryScroll* source = 0;
+    switch (type)
+    {
+    case 0: source = new CompactHistoryScroll(1000); break;
+    case 1: source = new HistoryScrollBuffer(1000); break;
+    case 2: source = new HistoryScrollFile(QString()); break;
+    case 3: source = new CompressedHistoryScroll(1000); break;
+    }
+    HistoryScrollReflow history(source);
+
+    // the type is the one of the source
+    QCOMPARE(&history.getType(), &source->getType());
+
+    QVector<Character> line(20, Character('x'));
+    history.addCellsVector(line);
+    history.addLine(false);
+
+    history.setColumns(10);
+    QCOMPARE(history.getLines(), expectedLines);
+    QCOMPARE(history.getLineLen(0), 20 / expectedLines);
+}
+
+QTEST_MAIN(TestHistory)
+
+#include "tst_history.moc"
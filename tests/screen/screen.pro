@@ -0,0 +1,6 @@
+TARGET = tst_screen
+
+include(../tests.pri)
+
+SOURCES += \
+    tst_screen.cpp
@@ -0,0 +1,250 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+// Own includes
+#include "screen.h"
+
+// Qt includes
+#include <QtTest>
+
+namespace
+{
+
+QVector<uint> textOf(const QString& text)
+{
+    QVector<uint> codePoints;
+    foreach(const uint c, text.toUcs4())
+        codePoints.append(c);
+    return codePoints;
+}
+
+// writes a line of text and moves the cursor to the start of the next line
+void writeLine(Screen& screen, const QVector<uint>& text)
+{
+    screen.displayCharacters(text.constData(), text.size());
+    screen.toStartOfLine();
+    screen.index();
+}
+
+// writes a different line of text on every line of the screen and returns them
+QStringList fillScreen(Screen& screen)
+{
+    QStringList lines;
+    for (int i = 0; i < screen.getLines(); i++)
+    {
+        lines.append(QString("line %1").arg(i));
+        screen.setCursorYX(i + 1, 1);
+        screen.displayCharacters(textOf(lines.last()).constData(), lines.last().size());
+    }
+    return lines;
+}
+
+// returns the text of the history and the screen, with wrapped lines joined
+QStringList logicalLines(const Screen& screen)
+{
+    const int lineCount = screen.getHistLines() + screen.getLines();
+    const int columns = screen.getColumns();
+    const QVector<LineProperty> properties = screen.getLineProperties(0, lineCount-1);
+
+    QStringList result;
+    QString text;
+    QVector<Character> image(columns);
+    for (int line = 0; line < lineCount; line++)
+    {
+        screen.getImage(image.data(), columns, line, line);
+
+        QString row;
+        for (int column = 0; column < columns; column++)
+            row.append(QChar(image.at(column).character));
+
+        if (properties.at(line) & LINE_WRAPPED)
+        {
+            text.append(row);
+        }
+        else
+        {
+            text.append(row);
+            result.append(text.trimmed());
+            text.clear();
+        }
+    }
+
+    while (!result.isEmpty() && result.last().isEmpty())
+        result.removeLast();
+    return result;
+}
+
+}
+
+class TestScreen : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void reflowKeepsTextBelowCursor();
+    void scrollUpWholeScreen();
+    void scrollUpWholeRegion();
+    void resizeWithHistory_data();
+    void resizeWithHistory();
+    void getImage_data();
+    void getImage();
+};
+
+void TestScreen::reflowKeepsTextBelowCursor()
+{
+    Screen screen(10, 20);
+    screen.setReflowLines(true);
+    screen.setScroll(CompactHistoryType(1000));
+
+    QStringList lines;
+    for (int i = 0; i < 5; i++)
+    {
+        lines.append(QString("line %1 0123456789").arg(i));
+        writeLine(screen, textOf(lines.last()));
+    }
+
+    // every line takes two rows at the new width, more than fit below the
+    // cursor
+    screen.home();
+    screen.resizeImage(4, 10);
+
+    QCOMPARE(logicalLines(screen), lines);
+    QCOMPARE(screen.getCursorY(), 0);
+}
+
+void TestScreen::scrollUpWholeScreen()
+{
+    Screen screen(5, 20);
+    screen.setScroll(CompactHistoryType(1000));
+
+    const QStringList lines = fillScreen(screen);
+
+    // CSI 100 S moves every line into the history and leaves the screen empty
+    screen.scrollUp(100);
+
+    QCOMPARE(screen.getHistLines(), 5);
+    QCOMPARE(logicalLines(screen), lines);
+}
+
+void TestScreen::scrollUpWholeRegion()
+{
+    Screen screen(5, 20);
+    screen.setScroll(CompactHistoryType(1000));
+
+    const QStringList lines = fillScreen(screen);
+
+    // the lines of a region below the top of the screen are cleared
+    screen.setMargins(2, 4);
+    screen.scrollUp(100);
+
+    QCOMPARE(screen.getHistLines(), 0);
+    QCOMPARE(logicalLines(screen), QStringList() << lines.at(0) << QString()
+                                                 << QString() << QString() << lines.at(4));
+}
+
+void TestScreen::resizeWithHistory_data()
+{
+    QTest::addColumn<int>("historyLines");
+
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+    QTest::newRow("1M") << 1000000;
+}
+
+void TestScreen::resizeWithHistory()
+{
+    QFETCH(int, historyLines);
+
+    Screen screen(40, 80);
+    screen.setReflowLines(true);
+    screen.setScroll(CompactHistoryType(historyLines));
+
+    // lines of 100 characters are wrapped in two at 80 columns
+    const QVector<uint> text = textOf(QString(100, QChar('x')));
+    while (screen.getHistLines() < historyLines)
+        writeLine(screen, text);
+
+    int columns = 80;
+    QVector<Character> image(40*100);
+    QBENCHMARK
+    {
+        columns = (columns == 80) ? 100 : 80;
+        screen.resizeImage(40, columns);
+
+        // the history is only wrapped at the new width when it is read,
+        // so read a window's worth of it as a view scrolled back would
+        const int lastLine = screen.getHistLines() - 1;
+        screen.getImage(image.data(), image.size(), lastLine - 39, lastLine);
+    }
+}
+
+void TestScreen::getImage_data()
+{
+    QTest::addColumn<bool>("selection");
+    QTest::addColumn<bool>("blockSelection");
+
+    QTest::newRow("no selection") << false << false;
+    QTest::newRow("selection") << true << false;
+    QTest::newRow("block selection") << true << true;
+}
+
+void TestScreen::getImage()
+{
+    QFETCH(bool, selection);
+    QFETCH(bool, blockSelection);
+
+    const int lines = 100;
+    const int columns = 300;
+    Screen screen(lines, columns);
+
+    QString text;
+    for (int i = 0; i < columns - 1; i++)
+        text.append(QChar('a' + i % 26));
+    for (int i = 0; i < lines; i++)
+    {
+        screen.setForeColor(COLOR_SPACE_SYSTEM, i % 8);
+        writeLine(screen, textOf(text));
+    }
+
+    // select the middle of the screen
+    if (selection)
+    {
+        screen.setSelectionStart(50, 20, blockSelection);
+        screen.setSelectionEnd(250, 80);
+        QVERIFY(screen.isSelected(100, 50));
+    }
+
+    const int historyLines = screen.getHistLines();
+    QVector<Character> image(lines * columns);
+    QBENCHMARK
+    {
+        screen.getImage(image.data(), image.size(), historyLines, historyLines + lines - 1);
+    }
+}
+
+QTEST_MAIN(TestScreen)
+
+#include "tst_screen.moc"
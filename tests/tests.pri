@@ -0,0 +1,12 @@
+QT += testlib widgets
+
+CONFIG += testcase c++14 console
+CONFIG -= app_bundle
+
+INCLUDEPATH += \
+    $$PWD/..
+
+LIBS += \
+    -L$$OUT_PWD/../.. -lqtterminalwidget
+PRE_TARGETDEPS += \
+    $$OUT_PWD/../../libqtterminalwidget.a
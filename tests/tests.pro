@@ -0,0 +1,16 @@
+# Unit tests and benchmarks.
+#
+# The tests link against the static library, which is expected in the
+# directory above the one this project is built in.  Build
+# qtterminalwidget.pro in a directory, then this project in its "tests"
+# subdirectory, and run "make check".  Benchmarks are run with
+# "make check TESTARGS=-median 5" or by running a test with -functions to
+# pick one.
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    charactercolor \
+    emulation \
+    history \
+    screen
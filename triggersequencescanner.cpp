@@ -0,0 +1,169 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+// Own includes
+#include "triggersequencescanner.h"
+
+// System includes
+#include <string.h>
+
+TriggerSequenceScanner::TriggerSequenceScanner()
+    : _leadByteCount(0),
+      _leadByte(0),
+      _nextId(0)
+{
+    memset(_isLeadByte, false, sizeof(_isLeadByte));
+}
+
+int TriggerSequenceScanner::addSequence(const QByteArray& sequence)
+{
+    Q_ASSERT(!sequence.isEmpty());
+
+    Sequence entry;
+    entry.id = _nextId++;
+    entry.bytes = sequence;
+    _sequences << entry;
+
+    updateLeadBytes();
+    return entry.id;
+}
+
+void TriggerSequenceScanner::removeSequence(int id)
+{
+    for (int i = 0; i < _sequences.count(); i++)
+    {
+        if (_sequences[i].id == id)
+        {
+            _sequences.remove(i);
+            break;
+        }
+    }
+
+    // indices into _sequences are no longer valid
+    _partialMatches.clear();
+    updateLeadBytes();
+}
+
+void TriggerSequenceScanner::reset()
+{
+    _partialMatches.clear();
+}
+
+void TriggerSequenceScanner::updateLeadBytes()
+{
+    memset(_isLeadByte, false, sizeof(_isLeadByte));
+    _leadByteCount = 0;
+
+    foreach (const Sequence& sequence, _sequences)
+    {
+        uchar lead = sequence.bytes.at(0);
+        if (!_isLeadByte[lead])
+        {
+            _isLeadByte[lead] = true;
+            _leadByte = lead;
+            _leadByteCount++;
+        }
+    }
+}
+
+void TriggerSequenceScanner::matchAt(const char* data, int length, int position, QVector<int>& found)
+{
+    int available = length - position;
+
+    for (int i = 0; i < _sequences.count(); i++)
+    {
+        const QByteArray& bytes = _sequences[i].bytes;
+        if (bytes.at(0) != data[position])
+            continue;
+
+        if (available >= bytes.size())
+        {
+            if (memcmp(data + position, bytes.constData(), bytes.size()) == 0)
+                found << _sequences[i].id;
+        }
+        else if (memcmp(data + position, bytes.constData(), available) == 0)
+        {
+            // the rest may follow in the next block
+            PartialMatch match = { i, available };
+            _partialMatches << match;
+        }
+    }
+}
+
+QVector<int> TriggerSequenceScanner::scan(const char* data, int length)
+{
+    QVector<int> found;
+
+    if (length <= 0 || _sequences.isEmpty())
+        return found;
+
+    // complete the sequences which were cut off by the end of the last block
+    if (!_partialMatches.isEmpty())
+    {
+        QVector<PartialMatch> partialMatches;
+        partialMatches.swap(_partialMatches);
+
+        foreach (const PartialMatch& match, partialMatches)
+        {
+            const QByteArray& bytes = _sequences[match.sequence].bytes;
+            int missing = bytes.size() - match.matched;
+            int count = qMin(missing, length);
+
+            if (memcmp(data, bytes.constData() + match.matched, count) != 0)
+                continue;
+
+            if (count == missing)
+            {
+                found << _sequences[match.sequence].id;
+            }
+            else
+            {
+                PartialMatch longerMatch = { match.sequence, match.matched + count };
+                _partialMatches << longerMatch;
+            }
+        }
+    }
+
+    if (_leadByteCount == 1)
+    {
+        const char* end = data + length;
+        const char* ptr = data;
+        while ((ptr = (const char*)memchr(ptr, _leadByte, end - ptr)))
+        {
+            matchAt(data, length, ptr - data, found);
+            ptr++;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < length; i++)
+        {
+            if (_isLeadByte[(uchar)data[i]])
+                matchAt(data, length, i, found);
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,85 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+
+#pragma once
+
+// Qt includes
+#include <QByteArray>
+#include <QVector>
+
+/**
+ * Watches a stream of bytes for a set of trigger sequences, such as the
+ * "\030B00" which announces a ZModem transfer.
+ *
+ * The stream is fed to scan() block by block.  Only the positions of the
+ * sequences' lead bytes are inspected, which are found with memchr() when
+ * all sequences share the same lead byte, so scanning costs next to nothing
+ * for input which contains no lead bytes at all.  Sequences which are split
+ * across two blocks are recognised when the second block arrives.
+ */
+class TriggerSequenceScanner {
+public:
+    TriggerSequenceScanner();
+
+    /**
+     * Adds @p sequence to the sequences to watch for and returns an id
+     * which identifies it in the results of scan().  @p sequence must not
+     * be empty.
+     */
+    int addSequence(const QByteArray& sequence);
+
+    /** Stops watching for the sequence with the given @p id. */
+    void removeSequence(int id);
+
+    /** Forgets about sequences which were partially seen at the end of the last block. */
+    void reset();
+
+    /**
+     * Scans the next @p length bytes of the stream and returns the ids of
+     * the sequences which were completed in them, in the order in which
+     * they occur.
+     */
+    QVector<int> scan(const char* data, int length);
+
+private:
+    struct Sequence {
+        int id;
+        QByteArray bytes;
+    };
+    struct PartialMatch {
+        int sequence; // index into _sequences
+        int matched;  // number of bytes seen so far
+    };
+
+    void updateLeadBytes();
+    void matchAt(const char* data, int length, int position, QVector<int>& found);
+
+    QVector<Sequence> _sequences;
+    QVector<PartialMatch> _partialMatches;
+    bool _isLeadByte[256];
+    int _leadByteCount;
+    char _leadByte; // the only lead byte if _leadByteCount is 1
+    int _nextId;
+};
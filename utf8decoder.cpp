@@ -0,0 +1,119 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+// Own includes
+#include "utf8decoder.h"
+
+// System includes
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define REPLACEMENT_CHARACTER 0xFFFD
+
+Utf8Decoder::Utf8Decoder()
+{
+    reset();
+}
+
+void Utf8Decoder::reset()
+{
+    _codePoint = 0;
+    _remaining = 0;
+    _lowerBound = 0x80;
+    _upperBound = 0xBF;
+}
+
+int Utf8Decoder::decode(uchar byte, uint* output)
+{
+    int count = 0;
+
+    if (_remaining) {
+        if (byte >= _lowerBound && byte <= _upperBound) {
+            _codePoint = (_codePoint << 6) | (byte & 0x3F);
+            _lowerBound = 0x80;
+            _upperBound = 0xBF;
+            if (--_remaining)
+                return 0;
+            output[0] = _codePoint;
+            return 1;
+        }
+
+        // the sequence was cut short, replace what we have got so far and
+        // process the byte as the start of something new
+        output[count++] = REPLACEMENT_CHARACTER;
+        reset();
+    }
+
+    if (byte < 0x80) {
+        output[count++] = byte;
+    } else if (byte >= 0xC2 && byte <= 0xDF) {
+        _codePoint = byte & 0x1F;
+        _remaining = 1;
+    } else if (byte >= 0xE0 && byte <= 0xEF) {
+        // reject overlong forms and UTF-16 surrogates
+        _codePoint = byte & 0x0F;
+        _remaining = 2;
+        _lowerBound = (byte == 0xE0) ? 0xA0 : 0x80;
+        _upperBound = (byte == 0xED) ? 0x9F : 0xBF;
+    } else if (byte >= 0xF0 && byte <= 0xF4) {
+        // reject overlong forms and anything beyond U+10FFFF
+        _codePoint = byte & 0x07;
+        _remaining = 3;
+        _lowerBound = (byte == 0xF0) ? 0x90 : 0x80;
+        _upperBound = (byte == 0xF4) ? 0x8F : 0xBF;
+    } else {
+        // stray continuation byte or a byte which never occurs in UTF-8
+        output[count++] = REPLACEMENT_CHARACTER;
+    }
+
+    return count;
+}
+
+int Utf8Decoder::printableAsciiLength(const char* text, int length)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    // Check 16 bytes at a time.  The comparisons are signed, so bytes with
+    // the high bit set count as negative and fail the lower bound check.
+    const __m128i lower = _mm_set1_epi8(0x1F);
+    const __m128i upper = _mm_set1_epi8(0x7F);
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(chunk, lower),
+                                          _mm_cmplt_epi8(chunk, upper));
+        int mask = _mm_movemask_epi8(printable);
+        if (mask != 0xFFFF)
+            return i + __builtin_ctz(~mask);
+    }
+#endif
+
+    for (; i < length; i++) {
+        uchar c = text[i];
+        if (c < 0x20 || c > 0x7E)
+            break;
+    }
+    return i;
+}
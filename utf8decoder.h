@@ -0,0 +1,83 @@
+/*
+ * Modifications and refactoring. Part of QtTerminalWidget:
+ * https://github.com/cybercatalyst/qtterminalwidget
+ *
+ * Copyright (C) 2015 Jacob Dawid <jacob@omg-it.works>
+ */
+
+/*
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#pragma once
+
+// Qt includes
+#include <QtGlobal>
+
+/**
+ * An incremental UTF-8 decoder for the terminal's input stream.
+ *
+ * Unlike QTextDecoder, which produces a QString for every block of input,
+ * the decoder is fed one byte at a time and hands back complete unicode
+ * code points.  Multi-byte sequences which are split across two blocks of
+ * input are completed when the next block arrives.
+ *
+ * Malformed input (stray continuation bytes, overlong forms, surrogates and
+ * truncated sequences) is replaced by U+FFFD, one replacement character per
+ * maximal invalid subpart, as recommended by the Unicode standard.
+ *
+ * Since almost all terminal output is plain ASCII, printableAsciiLength()
+ * allows the caller to skip the decoder entirely for runs of printable
+ * ASCII characters.
+ */
+class Utf8Decoder {
+public:
+    Utf8Decoder();
+
+    /** Discards any partially decoded multi-byte sequence. */
+    void reset();
+
+    /**
+     * Returns true if the decoder is in the middle of a multi-byte sequence,
+     * ie. if the next byte fed to decode() is expected to be a continuation
+     * byte.
+     */
+    bool hasPendingSequence() const { return _remaining != 0; }
+
+    /**
+     * Feeds a single byte of input into the decoder.
+     *
+     * @param byte The next byte of input.
+     * @param output Receives the decoded code points.  Must have room for
+     * at least two entries: a replacement character for an interrupted
+     * sequence followed by the code point started by @p byte.
+     * @return The number of code points written to @p output.
+     */
+    int decode(uchar byte, uint* output);
+
+    /**
+     * Returns the length of the run of printable ASCII characters
+     * (0x20 to 0x7E) at the start of @p text, which is at most @p length.
+     */
+    static int printableAsciiLength(const char* text, int length);
+
+private:
+    uint _codePoint;
+    int _remaining;
+    // permitted range of the next continuation byte
+    uchar _lowerBound;
+    uchar _upperBound;
+};
@@ -45,6 +45,7 @@ void scrolllock_set_on();
 
 // Standard includes
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <assert.h>
 
@@ -52,6 +53,8 @@ void scrolllock_set_on();
 #include <QEvent>
 #include <QKeyEvent>
 #include <QByteRef>
+#include <QMetaObject>
+#include <QThread>
 
 Vt102Emulation::Vt102Emulation() 
     : TerminalEmulation(),
@@ -60,7 +63,6 @@ Vt102Emulation::Vt102Emulation()
     _titleUpdateTimer->setSingleShot(true);
     QObject::connect(_titleUpdateTimer , SIGNAL(timeout()) , this , SLOT(updateTitle()));
 
-    initTokenizer();
     reset();
 }
 
@@ -69,12 +71,16 @@ Vt102Emulation::~Vt102Emulation()
 
 void Vt102Emulation::clearEntireScreen()
 {
+    QMutexLocker locker(screenLock());
+
     _currentScreen->clearEntireScreen();
     bufferedUpdate();
 }
 
 void Vt102Emulation::reset()
 {
+    QMutexLocker locker(screenLock());
+
     resetTokenizer();
     resetModes();
     resetCharset(0);
@@ -166,247 +172,500 @@ void Vt102Emulation::reset()
 
 /* The tokenizer's state
 
-   The state is represented by the buffer (tokenBuffer, tokenBufferPos),
-   and accompanied by decoded arguments kept in (argv,argc).
-   Note that they are kept internal in the tokenizer.
+   The tokenizer is a state machine modelled after the DEC compatible
+   parser described at http://vt100.net/emu/dec_ansi_parser
+
+   Every incoming character is first mapped to a character class.  The
+   current state and the character class then select an entry of the
+   transition table, which names the action to perform and the next state.
+   Both tables are computed at compile time, so each character costs two
+   table lookups and a switch over the action.
+
+   Besides the state, the tokenizer keeps the decoded arguments (argv,argc),
+   the private marker and intermediate character of a control sequence and,
+   for operating system commands, the text collected so far.
 */
 
-void Vt102Emulation::resetTokenizer()
+namespace {
+
+enum ParserState
 {
-    tokenBufferPos = 0;
-    argc = 0;
-    argv[0] = 0;
-    argv[1] = 0;
-}
+    Ground,            // printable characters are displayed
+    Escape,            // after ESC
+    EscapeCharset,     // after ESC and one of ( ) * + %
+    EscapeHash,        // after ESC #
+    CsiEntry,          // after ESC [
+    CsiParam,          // collecting the arguments of a control sequence
+    CsiIntermediate,   // collecting intermediate characters
+    CsiIgnore,         // skipping a malformed control sequence
+    OscString,         // collecting the text of ESC ] ... BEL
+    Vt52Escape,        // after ESC in VT52 mode
+    Vt52CursorRow,     // after ESC Y in VT52 mode
+    Vt52CursorColumn,  // after ESC Y <row> in VT52 mode
+    ParserStateCount
+};
+
+enum CharacterClass
+{
+    ClassControl,           // C0 controls not listed below
+    ClassCancel,            // CAN and SUB
+    ClassEscape,            // ESC
+    ClassBell,              // BEL
+    ClassIntermediate,      // 0x20 - 0x2F not listed below
+    ClassCharsetDesignator, // ( ) * + %
+    ClassHash,              // #
+    ClassDigit,             // 0 - 9
+    ClassColon,             // :
+    ClassSemicolon,         // ;
+    ClassPrivate,           // < = > ?
+    ClassCsiIntroducer,     // [
+    ClassOscIntroducer,     // ]
+    ClassCursorAddress,     // Y
+    ClassFinal,             // 0x40 - 0x7E not listed above
+    ClassDelete,            // DEL
+    ClassCsi,               // 8-bit CSI (0x9B)
+    ClassOther,             // everything above 0x7F not listed above
+    CharacterClassCount
+};
+
+enum ParserAction
+{
+    ActionIgnore,
+    ActionPrint,            // display the character
+    ActionExecute,          // process a control character
+    ActionEscape,           // start a new escape sequence
+    ActionClear,            // start a new control sequence (8-bit CSI)
+    ActionCollect,          // remember a private marker or intermediate character
+    ActionParam,            // add a digit to the current argument
+    ActionNextParam,        // start the next argument
+    ActionEscDispatch,      // ESC <char>
+    ActionCharsetDispatch,  // ESC ( <char> and friends
+    ActionHashDispatch,     // ESC # <char>
+    ActionCsiDispatch,      // ESC [ ... <final>
+    ActionOscStart,
+    ActionOscPut,
+    ActionOscEnd,
+    ActionVt52Dispatch,     // ESC <char> in VT52 mode
+    ActionVt52Row,
+    ActionVt52Cursor        // ESC Y <row> <column> in VT52 mode
+};
+
+struct ParserTransition
+{
+    quint8 action;
+    quint8 state;
+};
 
-void Vt102Emulation::addDigit(int digit)
+constexpr quint8 characterClass(int c)
 {
-    if (argv[argc] < MAX_ARGUMENT)
-        argv[argc] = 10*argv[argc] + digit;
+    if (c == 0x18 || c == 0x1A) return ClassCancel;
+    if (c == 0x1B)              return ClassEscape;
+    if (c == 0x07)              return ClassBell;
+    if (c < 0x20)               return ClassControl;
+    if (c == '(' || c == ')' || c == '*' || c == '+' || c == '%')
+                                return ClassCharsetDesignator;
+    if (c == '#')               return ClassHash;
+    if (c < 0x30)               return ClassIntermediate;
+    if (c < 0x3A)               return ClassDigit;
+    if (c == ':')               return ClassColon;
+    if (c == ';')               return ClassSemicolon;
+    if (c < 0x40)               return ClassPrivate;
+    if (c == '[')               return ClassCsiIntroducer;
+    if (c == ']')               return ClassOscIntroducer;
+    if (c == 'Y')               return ClassCursorAddress;
+    if (c < 0x7F)               return ClassFinal;
+    if (c == 0x7F)              return ClassDelete;
+    if (c == 0x9B)              return ClassCsi;
+    return ClassOther;
 }
 
-void Vt102Emulation::addArgument()
+constexpr ParserTransition to(ParserAction action, ParserState state)
 {
-    argc = qMin(argc+1,MAXARGS-1);
-    argv[argc] = 0;
+    return ParserTransition { quint8(action), quint8(state) };
 }
 
-void Vt102Emulation::addToCurrentToken(int cc)
+constexpr ParserTransition transition(int state, int charClass)
 {
-    tokenBuffer[tokenBufferPos] = cc;
-    tokenBufferPos = qMin(tokenBufferPos+1,MAX_TOKEN_LENGTH-1);
-}
+    // transitions which apply in every state
+    switch (charClass)
+    {
+    case ClassCancel: return to(ActionExecute, Ground);
+    case ClassEscape: return to(ActionEscape, Escape);
+    case ClassDelete: return to(ActionIgnore, ParserState(state));
+    }
 
-// Character Class flags used while decoding
+    // C0 controls are executed in the middle of escape sequences,
+    // except in strings where they are not allowed
+    if (charClass == ClassControl || charClass == ClassBell)
+    {
+        if (state != OscString)
+            return to(ActionExecute, ParserState(state));
+        return charClass == ClassBell ? to(ActionOscEnd, Ground)
+                                      : to(ActionIgnore, OscString);
+    }
 
-#define CTL  1  // Control character
-#define CHR  2  // Printable character
-#define CPN  4  // TODO: Document me 
-#define DIG  8  // Digit
-#define SCS 16  // TODO: Document me  
-#define GRP 32  // TODO: Document me
-#define CPS 64  // Character which indicates end of window resize
-// escape sequence '\e[8;<row>;<col>t'
+    // in a sequence, 0x20 - 0x2F are intermediates and 0x40 - 0x7E finals
+    const bool intermediate = charClass == ClassIntermediate ||
+                              charClass == ClassCharsetDesignator ||
+                              charClass == ClassHash;
+    const bool parameter = charClass == ClassDigit || charClass == ClassColon ||
+                           charClass == ClassSemicolon || charClass == ClassPrivate;
+    const bool final = charClass == ClassCsiIntroducer || charClass == ClassOscIntroducer ||
+                       charClass == ClassCursorAddress || charClass == ClassFinal;
 
-void Vt102Emulation::initTokenizer()
-{ 
-    int i;
-    quint8* s;
-    for(i = 0;i < 256; ++i)
-        charClass[i] = 0;
-    for(i = 0;i < 32; ++i)
-        charClass[i] |= CTL;
-    for(i = 32;i < 256; ++i)
-        charClass[i] |= CHR;
-    for(s = (quint8*)"@ABCDGHILMPSTXZcdfry"; *s; ++s)
-        charClass[*s] |= CPN;
-    // resize = \e[8;<row>;<col>t
-    for(s = (quint8*)"t"; *s; ++s)
-        charClass[*s] |= CPS;
-    for(s = (quint8*)"0123456789"; *s; ++s)
-        charClass[*s] |= DIG;
-    for(s = (quint8*)"()+*%"; *s; ++s)
-        charClass[*s] |= SCS;
-    for(s = (quint8*)"()+*#[]%"; *s; ++s)
-        charClass[*s] |= GRP;
+    switch (state)
+    {
+    case Ground:
+        if (charClass == ClassCsi)
+            return to(ActionClear, CsiEntry);
+        return to(ActionPrint, Ground);
+
+    case Escape:
+        if (charClass == ClassCharsetDesignator) return to(ActionCollect, EscapeCharset);
+        if (charClass == ClassHash)              return to(ActionIgnore, EscapeHash);
+        if (charClass == ClassCsiIntroducer)     return to(ActionIgnore, CsiEntry);
+        if (charClass == ClassOscIntroducer)     return to(ActionOscStart, OscString);
+        if (intermediate || parameter || final)  return to(ActionEscDispatch, Ground);
+        break;
 
-    resetTokenizer();
+    case EscapeCharset:
+        if (intermediate || parameter || final)  return to(ActionCharsetDispatch, Ground);
+        break;
+
+    case EscapeHash:
+        if (intermediate || parameter || final)  return to(ActionHashDispatch, Ground);
+        break;
+
+    case CsiEntry:
+        if (charClass == ClassPrivate)           return to(ActionCollect, CsiParam);
+        // fall through
+    case CsiParam:
+        if (charClass == ClassDigit)             return to(ActionParam, CsiParam);
+        if (charClass == ClassSemicolon)         return to(ActionNextParam, CsiParam);
+        if (parameter)                           return to(ActionIgnore, CsiIgnore);
+        if (intermediate)                        return to(ActionCollect, CsiIntermediate);
+        if (final)                               return to(ActionCsiDispatch, Ground);
+        break;
+
+    case CsiIntermediate:
+        if (intermediate)                        return to(ActionCollect, CsiIntermediate);
+        if (parameter)                           return to(ActionIgnore, CsiIgnore);
+        if (final)                               return to(ActionCsiDispatch, Ground);
+        break;
+
+    case CsiIgnore:
+        if (final)                               return to(ActionIgnore, Ground);
+        if (intermediate || parameter)           return to(ActionIgnore, CsiIgnore);
+        break;
+
+    case OscString:
+        return to(ActionOscPut, OscString);
+
+    case Vt52Escape:
+        if (charClass == ClassCursorAddress)     return to(ActionIgnore, Vt52CursorRow);
+        if (intermediate || parameter || final)  return to(ActionVt52Dispatch, Ground);
+        break;
+
+    case Vt52CursorRow:
+        if (intermediate || parameter || final)  return to(ActionVt52Row, Vt52CursorColumn);
+        break;
+
+    case Vt52CursorColumn:
+        if (intermediate || parameter || final)  return to(ActionVt52Cursor, Ground);
+        break;
+    }
+
+    // anything else aborts the sequence and is displayed as it is
+    return to(ActionPrint, Ground);
 }
 
-/* Ok, here comes the nasty part of the decoder.
+struct ParserTables
+{
+    constexpr ParserTables()
+        : characterClasses()
+        , transitions()
+    {
+        for (int c = 0; c < 256; c++)
+            characterClasses[c] = characterClass(c);
+        for (int state = 0; state < ParserStateCount; state++)
+            for (int charClass = 0; charClass < CharacterClassCount; charClass++)
+                transitions[state][charClass] = transition(state, charClass);
+    }
 
-   Instead of keeping an explicit state, we deduce it from the
-   token scanned so far. It is then immediately combined with
-   the current character to form a scanning decision.
+    quint8 characterClasses[256];
+    ParserTransition transitions[ParserStateCount][CharacterClassCount];
+};
 
-   This is done by the following defines.
+constexpr ParserTables parserTables;
 
-   - P is the length of the token scanned so far.
-   - L (often P-1) is the position on which contents we base a decision.
-   - C is a character or a group of characters (taken from 'charClass').
-   
-   - 'cc' is the current character
-   - 's' is a pointer to the start of the token buffer
-   - 'p' is the current position within the token buffer
+} // namespace
 
-   Note that they need to applied in proper order.
-*/
+#define MAX_OSC_LENGTH 4096
+
+void Vt102Emulation::resetTokenizer()
+{
+    _parserState = Ground;
+    _prefix = 0;
+    _intermediate = 0;
+    argc = 0;
+    argv[0] = 0;
+    argv[1] = 0;
+}
+
+void Vt102Emulation::addDigit(int digit)
+{
+    if (argv[argc] < MAX_ARGUMENT)
+        argv[argc] = 10*argv[argc] + digit;
+}
 
-#define lec(P,L,C) (p == (P) && s[(L)] == (C))
-#define lun(     ) (p ==  1  && cc >= 32 )
-#define les(P,L,C) (p == (P) && s[L] < 256 && (charClass[s[(L)]] & (C)) == (C))
-#define eec(C)     (p >=  3  && cc == (C))
-#define ees(C)     (p >=  3  && cc < 256 && (charClass[cc] & (C)) == (C))
-#define eps(C)     (p >=  3  && s[2] != '?' && s[2] != '!' && s[2] != '>' && cc < 256 && (charClass[cc] & (C)) == (C))
-#define epp( )     (p >=  3  && s[2] == '?')
-#define epe( )     (p >=  3  && s[2] == '!')
-#define egt( )     (p >=  3  && s[2] == '>')
-#define Xpe        (tokenBufferPos >= 2 && tokenBuffer[1] == ']')
-#define Xte        (Xpe      && cc ==  7 )
-#define ces(C)     (cc < 256 && (charClass[cc] & (C)) == (C) && !Xte)
+void Vt102Emulation::addArgument()
+{
+    argc = qMin(argc+1,MAXARGS-1);
+    argv[argc] = 0;
+}
 
 #define ESC 27
 #define CNTL(c) ((c)-'@')
 
 // process an incoming unicode character
 void Vt102Emulation::receiveChar(int cc)
-{ 
-    if (cc == 127)
-        return; //VT100: ignore.
+{
+    const int charClass = cc < 256 ? parserTables.characterClasses[cc] : int(ClassOther);
+    const ParserTransition& next = parserTables.transitions[_parserState][charClass];
+    const int previousState = _parserState;
 
-    if (ces(CTL))
+    // actions may override the state, so switch first
+    _parserState = next.state;
+
+    switch (next.action)
     {
+    case ActionIgnore:
+        break;
+    case ActionPrint:
+        if (getMode(MODE_Ansi))
+            processToken( TY_CHR(), applyCharset(cc), 0);
+        else
+            processToken( TY_CHR(), cc, 0);
+        break;
+    case ActionExecute:
         // DEC HACK ALERT! Control Characters are allowed *within* esc sequences in VT100
         // This means, they do neither a resetTokenizer() nor a pushToToken(). Some of them, do
         // of course. Guess this originates from a weakly layered handling of the X-on
         // X-off protocol, which comes really below this level.
-        if (cc == CNTL('X') || cc == CNTL('Z') || cc == ESC)
+        if (cc == CNTL('X') || cc == CNTL('Z'))
             resetTokenizer(); //VT100: CAN or SUB
-        if (cc != ESC)
+        processToken( TY_CTL(cc+'@'), 0, 0);
+        break;
+    case ActionEscape:
+        // ESC terminates a pending operating system command (ESC \ is ST)
+        if (previousState == OscString)
+            processWindowAttributeChange();
+        resetTokenizer();
+        _parserState = getMode(MODE_Ansi) ? Escape : Vt52Escape;
+        break;
+    case ActionClear:
+        if (getMode(MODE_Ansi))
         {
-            processToken(TY_CTL(cc+'@' ),0,0);
-            return;
+            resetTokenizer();
+            _parserState = CsiEntry;
         }
+        else
+        {
+            _parserState = Ground;
+            processToken( TY_CHR(), cc, 0);
+        }
+        break;
+    case ActionCollect:
+        if (_parserState == CsiParam)
+            _prefix = cc;
+        else
+            _intermediate = cc;
+        break;
+    case ActionParam:
+        addDigit(cc-'0');
+        break;
+    case ActionNextParam:
+        addArgument();
+        break;
+    case ActionEscDispatch:
+        processToken( TY_ESC(cc), 0, 0);
+        break;
+    case ActionCharsetDispatch:
+        processToken( TY_ESC_CS(_intermediate,cc), 0, 0);
+        break;
+    case ActionHashDispatch:
+        processToken( TY_ESC_DE(cc), 0, 0);
+        break;
+    case ActionCsiDispatch:
+        processControlSequence(cc);
+        break;
+    case ActionOscStart:
+        _oscText.resize(0);
+        break;
+    case ActionOscPut:
+        if (_oscText.length() < MAX_OSC_LENGTH)
+            appendCodePoint(_oscText, cc);
+        break;
+    case ActionOscEnd:
+        processWindowAttributeChange();
+        break;
+    case ActionVt52Dispatch:
+        processToken( TY_VT52(cc), 0, 0);
+        break;
+    case ActionVt52Row:
+        argv[0] = cc;
+        break;
+    case ActionVt52Cursor:
+        processToken( TY_VT52('Y'), argv[0], cc);
+        break;
     }
-    // advance the state
-    addToCurrentToken(cc);
-
-    int* s = tokenBuffer;
-    int  p = tokenBufferPos;
+}
 
-    if (getMode(MODE_Ansi))
+// process the final character of a control sequence (ESC [ ...)
+void Vt102Emulation::processControlSequence(int cc)
+{
+    if (_intermediate)
     {
-        if (lec(1,0,ESC)) { return; }
-        if (lec(1,0,ESC+128)) { s[0] = ESC; receiveChar('['); return; }
-        if (les(2,1,GRP)) { return; }
-        if (Xte         ) { processWindowAttributeChange(); resetTokenizer(); return; }
-        if (Xpe         ) { return; }
-        if (lec(3,2,'?')) { return; }
-        if (lec(3,2,'>')) { return; }
-        if (lec(3,2,'!')) { return; }
-        if (lun(       )) { processToken( TY_CHR(), applyCharset(cc), 0);   resetTokenizer(); return; }
-        if (lec(2,0,ESC)) { processToken( TY_ESC(s[1]), 0, 0);              resetTokenizer(); return; }
-        if (les(3,1,SCS)) { processToken( TY_ESC_CS(s[1],s[2]), 0, 0);      resetTokenizer(); return; }
-        if (lec(3,1,'#')) { processToken( TY_ESC_DE(s[2]), 0, 0);           resetTokenizer(); return; }
-        if (eps(    CPN)) { processToken( TY_CSI_PN(cc), argv[0],argv[1]);  resetTokenizer(); return; }
+        // ESC [ ! p is the only sequence with an intermediate we know
+        // and others, such as DECSCUSR (ESC [ Ps SP q), are ignored
+        if (_intermediate == '!' && !_prefix)
+            processToken( TY_CSI_PE(cc), 0, 0);
+        return;
+    }
 
-        // resize = \e[8;<row>;<col>t
-        if (eps(CPS))
-        {
-            processToken( TY_CSI_PS(cc, argv[0]), argv[1], argv[2]);
-            resetTokenizer();
-            return;
-        }
+    if (_prefix == '?')
+    {
+        for (int i=0;i<=argc;i++)
+            processToken( TY_CSI_PR(cc,argv[i]), 0, 0);
+        return;
+    }
 
-        if (epe(   )) { processToken( TY_CSI_PE(cc), 0, 0); resetTokenizer(); return; }
-        if (ees(DIG)) { addDigit(cc-'0'); return; }
-        if (eec(';')) { addArgument();    return; }
+    if (_prefix == '>')
+    {
         for (int i=0;i<=argc;i++)
-        {
-            if (epp())
-                processToken( TY_CSI_PR(cc,argv[i]), 0, 0);
-            else if (egt())
-                processToken( TY_CSI_PG(cc), 0, 0); // spec. case for ESC]>0c or ESC]>c
-            else if (cc == 'm' && argc - i >= 4 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 2)
-            {
-                // ESC[ ... 48;2;<red>;<green>;<blue> ... m -or- ESC[ ... 38;2;<red>;<green>;<blue> ... m
-                i += 2;
-                processToken( TY_CSI_PS(cc, argv[i-2]), COLOR_SPACE_RGB, (argv[i] << 16) | (argv[i+1] << 8) | argv[i+2]);
-                i += 2;
-            }
-            else if (cc == 'm' && argc - i >= 2 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 5)
-            {
-                // ESC[ ... 48;5;<index> ... m -or- ESC[ ... 38;5;<index> ... m
-                i += 2;
-                processToken( TY_CSI_PS(cc, argv[i-2]), COLOR_SPACE_256, argv[i]);
-            }
-            else
-                processToken( TY_CSI_PS(cc,argv[i]), 0, 0);
-        }
-        resetTokenizer();
+            processToken( TY_CSI_PG(cc), 0, 0); // spec. case for ESC]>0c or ESC]>c
+        return;
     }
-    else
+
+    // sequences with other private markers are not supported
+    if (_prefix)
+        return;
+
+    if (strchr("@ABCDGHILMPSTXZcdfry", cc))
+    {
+        processToken( TY_CSI_PN(cc), argv[0],argv[1]);
+        return;
+    }
+
+    // resize = \e[8;<row>;<col>t
+    if (cc == 't')
     {
-        // VT52 Mode
-        if (lec(1,0,ESC))
-            return;
-        if (les(1,0,CHR))
+        processToken( TY_CSI_PS(cc, argv[0]), argv[1], argv[2]);
+        return;
+    }
+
+    for (int i=0;i<=argc;i++)
+    {
+        if (cc == 'm' && argc - i >= 4 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 2)
         {
-            processToken( TY_CHR(), s[0], 0);
-            resetTokenizer();
-            return;
+            // ESC[ ... 48;2;<red>;<green>;<blue> ... m -or- ESC[ ... 38;2;<red>;<green>;<blue> ... m
+            i += 2;
+            processToken( TY_CSI_PS(cc, argv[i-2]), COLOR_SPACE_RGB, (argv[i] << 16) | (argv[i+1] << 8) | argv[i+2]);
+            i += 2;
         }
-        if (lec(2,1,'Y'))
-            return;
-        if (lec(3,1,'Y'))
-            return;
-        if (p < 4)
+        else if (cc == 'm' && argc - i >= 2 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 5)
         {
-            processToken( TY_VT52(s[1] ), 0, 0);
-            resetTokenizer();
-            return;
+            // ESC[ ... 48;5;<index> ... m -or- ESC[ ... 38;5;<index> ... m
+            i += 2;
+            processToken( TY_CSI_PS(cc, argv[i-2]), COLOR_SPACE_256, argv[i]);
         }
-        processToken( TY_VT52(s[1]), s[2], s[3]);
-        resetTokenizer();
-        return;
+        else
+            processToken( TY_CSI_PS(cc,argv[i]), 0, 0);
+    }
+}
+
+// process a run of printable ASCII characters
+void Vt102Emulation::receivePrintableRun(const char* text, int length)
+{
+    // finish any escape sequence in progress one character at a time
+    while (length > 0 && _parserState != Ground)
+    {
+        receiveChar(*text++);
+        length--;
+    }
+
+    // back in the ground state every printable character is displayed
+    // as it is, so send the rest to the screen in blocks
+    const bool ansi = getMode(MODE_Ansi);
+    uint characters[256];
+    while (length > 0)
+    {
+        int count = qMin(length, 256);
+        for (int i = 0; i < count; i++)
+            characters[i] = ansi ? applyCharset(text[i]) : text[i];
+
+        _currentScreen->displayCharacters(characters, count);
+        text += count;
+        length -= count;
+    }
+}
+
+// process a run of printable characters beyond ASCII
+void Vt102Emulation::receivePrintableCodePoints(const uint* codePoints, int length)
+{
+    // they are part of an operating system command or end a malformed
+    // escape sequence unless the parser is in the ground state
+    while (length > 0 && _parserState != Ground)
+    {
+        receiveChar(*codePoints++);
+        length--;
     }
+
+    // the character sets only replace ASCII characters, so these are
+    // displayed as they are
+    if (length > 0)
+        _currentScreen->displayCharacters(codePoints, length);
 }
+
 void Vt102Emulation::processWindowAttributeChange()
 {
     // Describes the window or terminal session attribute to change
     // See Session::UserTitleChange for possible values
     int attributeToChange = 0;
     int i;
-    for (i = 2; i < tokenBufferPos     &&
-         tokenBuffer[i] >= '0'  &&
-         tokenBuffer[i] <= '9'; i++)
+    for (i = 0; i < _oscText.length() &&
+         _oscText[i] >= '0' &&
+         _oscText[i] <= '9'; i++)
     {
-        attributeToChange = 10 * attributeToChange + (tokenBuffer[i]-'0');
+        attributeToChange = 10 * attributeToChange + (_oscText[i].unicode()-'0');
     }
 
-    if (tokenBuffer[i] != ';')
+    if (i == _oscText.length() || _oscText[i] != ';')
     {
-        reportDecodingError();
+        printf("Undecodable sequence: \\033]%s\n", qPrintable(_oscText));
         return;
     }
 
-    QString newValue;
-    newValue.reserve(tokenBufferPos-i-2);
-    for (int j = 0; j < tokenBufferPos-i-2; j++)
-        newValue[j] = tokenBuffer[i+1+j];
+    _pendingTitleUpdates[attributeToChange] = _oscText.mid(i+1);
 
-    _pendingTitleUpdates[attributeToChange] = newValue;
-    _titleUpdateTimer->start(20);
+    // the timer belongs to the emulation's thread, which need not be the
+    // thread the input is parsed on
+    QMetaObject::invokeMethod(_titleUpdateTimer, "start", Qt::AutoConnection, Q_ARG(int, 20));
 }
 
 void Vt102Emulation::updateTitle()
 {
-    QListIterator<int> iter( _pendingTitleUpdates.keys() );
+    QHash<int,QString> pendingTitleUpdates;
+    {
+        QMutexLocker locker(screenLock());
+        pendingTitleUpdates.swap(_pendingTitleUpdates);
+    }
+
+    QListIterator<int> iter( pendingTitleUpdates.keys() );
     while (iter.hasNext()) {
         int arg = iter.next();
-        emit titleChanged( arg , _pendingTitleUpdates[arg] );
+        emit titleChanged( arg , pendingTitleUpdates[arg] );
     }
-    _pendingTitleUpdates.clear();
 }
 
 // Interpreting Codes ---------------------------------------------------------
@@ -472,6 +731,7 @@ void Vt102Emulation::processToken(int token, int p, int q)
     case TY_CTL('^'      ) : /* RS : ignored                      */ break;
     case TY_CTL('_'      ) : /* US : ignored                      */ break;
 
+    case TY_ESC('\\'     ) : /* ST: terminates ESC ], see receiveChar() */ break;
     case TY_ESC('D'      ) : _currentScreen->index                (          ); break; //VT100
     case TY_ESC('E'      ) : _currentScreen->nextLine             (          ); break; //VT100
     case TY_ESC('H'      ) : _currentScreen->changeTabStop        (true      ); break; //VT100
@@ -777,7 +1037,7 @@ void Vt102Emulation::processToken(int token, int p, int q)
     case TY_CSI_PG('c'      ) :  reportSecondaryAttributes(          ); break; //VT100
 
     default:
-        reportDecodingError();
+        reportDecodingError(token, p, q);
         break;
     };
 }
@@ -792,10 +1052,19 @@ void Vt102Emulation::clearScreenAndSetColumns(int columnCount)
 
 void Vt102Emulation::sendString(const char* s , int length)
 {
-    if ( length >= 0 )
-        emit sendData(s,length);
-    else
-        emit sendData(s,strlen(s));
+    if ( length < 0 )
+        length = strlen(s);
+
+    // replies to the terminal program are usually built in buffers on the
+    // stack, so they are copied when they have to cross threads
+    if ( QThread::currentThread() != thread() )
+    {
+        QMetaObject::invokeMethod(this, "sendQueuedData", Qt::QueuedConnection,
+                                  Q_ARG(QByteArray, QByteArray(s,length)));
+        return;
+    }
+
+    emit sendData(s,length);
 }
 
 void Vt102Emulation::reportCursorPosition()
@@ -891,6 +1160,8 @@ void Vt102Emulation::sendText( QString text )
 }
 void Vt102Emulation::sendKeyEvent( QKeyEvent* event )
 {
+    QMutexLocker locker(screenLock());
+
     Qt::KeyboardModifiers modifiers = event->modifiers();
     KeyboardTranslator::States states = KeyboardTranslator::NoState;
 
@@ -1006,7 +1277,7 @@ void Vt102Emulation::sendKeyEvent( QKeyEvent* event )
 
 // Apply current character map.
 
-unsigned short Vt102Emulation::applyCharset(unsigned short c)
+uint Vt102Emulation::applyCharset(uint c)
 {
     if (CHARSET.graphic && 0x5f <= c && c <= 0x7e) return vt100_graphics[c-0x5f];
     if (CHARSET.pound && c == '#' ) return 0xa3; //This mode is obsolete
@@ -1204,29 +1475,27 @@ char Vt102Emulation::eraseChar() const
         return '\b';
 }
 
-// print contents of the scan buffer
-static void hexdump(int* s, int len)
-{ int i;
-    for (i = 0; i < len; i++)
+// print a token which could not be interpreted
+void Vt102Emulation::reportDecodingError(int token, int p, int q)
+{
+    const int type = token & 0xff;
+    const int a = (token >> 8) & 0xff;
+    const int n = (token >> 16) & 0xffff;
+
+    switch (type)
     {
-        if (s[i] == '\\')
-            printf("\\\\");
-        else
-            if ((s[i]) > 32 && s[i] < 127)
-                printf("%c",s[i]);
-            else
-                printf("\\%04x(hex)",s[i]);
+    case 1:  printf("Undecodable sequence: \\%04x(hex)\n", a-'@');      break;
+    case 2:  printf("Undecodable sequence: \\033%c\n", a);             break;
+    case 3:  printf("Undecodable sequence: \\033%c%c\n", a, n);        break;
+    case 4:  printf("Undecodable sequence: \\033#%c\n", a);            break;
+    case 5:  printf("Undecodable sequence: \\033[%d%c\n", n, a);       break;
+    case 6:  printf("Undecodable sequence: \\033[%d;%d%c\n", p, q, a); break;
+    case 7:  printf("Undecodable sequence: \\033[?%d%c\n", n, a);      break;
+    case 8:  printf("Undecodable sequence: \\033%c (VT52)\n", a);      break;
+    case 9:  printf("Undecodable sequence: \\033[>%c\n", a);           break;
+    case 10: printf("Undecodable sequence: \\033[!%c\n", a);           break;
     }
 }
 
-void Vt102Emulation::reportDecodingError()
-{
-    if (tokenBufferPos == 0 || ( tokenBufferPos == 1 && (tokenBuffer[0] & 0xff) >= 32) )
-        return;
-    printf("Undecodable sequence: ");
-    hexdump(tokenBuffer,tokenBufferPos);
-    printf("\n");
-}
-
 //#include "Vt102Emulation.moc"
 
@@ -98,6 +98,8 @@ protected:
     virtual void setMode(int mode);
     virtual void resetMode(int mode);
     virtual void receiveChar(int cc);
+    virtual void receivePrintableRun(const char* text, int length);
+    virtual void receivePrintableCodePoints(const uint* codePoints, int length);
 
 private slots:
     //causes changeTitle() to be emitted for each (int,QString) pair in pendingTitleUpdates
@@ -105,7 +107,7 @@ private slots:
     void updateTitle();
 
 private:
-    unsigned short applyCharset(unsigned short c);
+    uint applyCharset(uint c);
     void setCharset(int n, int cs);
     void useCharset(int n);
     void setAndUseCharset(int n, int cs);
@@ -128,25 +130,22 @@ private:
     void resetModes();
 
     void resetTokenizer();
-#define MAX_TOKEN_LENGTH 80
-    void addToCurrentToken(int cc);
-    int tokenBuffer[MAX_TOKEN_LENGTH]; //FIXME: overflow?
-    int tokenBufferPos;
-#define MAXARGS 15
     void addDigit(int dig);
     void addArgument();
+#define MAXARGS 15
     int argv[MAXARGS];
     int argc;
-    void initTokenizer();
 
-    // Set of flags for each of the ASCII characters which indicates
-    // what category they fall into (printable character, control, digit etc.)
-    // for the purposes of decoding terminal output
-    int charClass[256];
+    // state of the tokenizer, see receiveChar()
+    int _parserState;
+    int _prefix;        // private marker of a control sequence, eg. '?'
+    int _intermediate;  // intermediate character of an escape or control sequence
+    QString _oscText;   // text of an operating system command (ESC ] ... BEL)
 
-    void reportDecodingError();
+    void reportDecodingError(int token, int p, int q);
 
     void processToken(int code, int p, int q);
+    void processControlSequence(int cc);
     void processWindowAttributeChange();
 
     void reportTerminalType();